@@ -0,0 +1,314 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "bench.hpp"
+
+using namespace std;
+using namespace nlohmann;
+
+namespace bench {
+    bool parseOptions(int argc, char** argv, Options& options) {
+        for (int i = 1; i < argc; ++i) {
+            if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+                options.filter = argv[++i];
+            }
+            else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+                options.minSeconds = atof(argv[++i]);
+            }
+            else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+                options.threads = strtoul(argv[++i], nullptr, 10);
+            }
+            else if (strcmp(argv[i], "--compare") == 0 && i + 2 < argc) {
+                options.baseline = argv[++i];
+                options.compare = argv[++i];
+            }
+            else {
+                return false;
+            }
+        }
+
+        return options.minSeconds > 0;
+    }
+
+    void Runner::record(const Result& result) {
+        // Progress goes to stderr so stdout is only the report.
+        cerr << left << setw(40) << result.name << right
+            << setw(12) << (uint64_t)result.nsPerOp << " ns/op"
+            << setw(12) << (uint64_t)(result.bytesPerSecond / (1024 * 1024)) << " MB/s";
+
+        if (allocationsCounted) {
+            cerr << setw(10) << fixed << setprecision(1) << result.allocsPerOp << " allocs/op";
+        }
+
+        cerr << endl;
+
+        m_results.push_back(result);
+    }
+
+    void Runner::record(const ScalingResult& result) {
+        cerr << left << setw(40) << (result.name + " x" + to_string(result.threads)) << right
+            << setw(12) << (uint64_t)result.opsPerSecond << " ops/s"
+            << setw(10) << (uint64_t)result.p50 << " p50"
+            << setw(10) << (uint64_t)result.p99 << " p99"
+            << setw(10) << (uint64_t)result.p999 << " p999"
+            << setw(8) << fixed << setprecision(2) << result.efficiency << " efficiency" << endl;
+
+        m_scalingResults.push_back(result);
+    }
+
+    namespace {
+        void pin(size_t thread) {
+#ifdef __linux__
+            auto cores = std::thread::hardware_concurrency();
+            cpu_set_t set;
+
+            CPU_ZERO(&set);
+            CPU_SET(thread % (cores == 0 ? 1 : cores), &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+            (void)thread;
+#endif
+        }
+
+        double percentile(const vector<uint32_t>& sorted, double p) {
+            if (sorted.empty()) {
+                return 0;
+            }
+
+            return sorted[(size_t)(p * (sorted.size() - 1))];
+        }
+    }
+
+    void Runner::scale(const string& name, const vector<size_t>& threadCounts, const function<size_t(size_t, size_t)>& fn) {
+        if (!selected(name)) {
+            return;
+        }
+
+        // Enough room that recording a latency never allocates while timing.
+        constexpr size_t maxSamples = 1 << 20;
+        double singleThreaded = 0;
+
+        for (auto threads : threadCounts) {
+            atomic<size_t> ready{ 0 };
+            atomic<bool> go{ false };
+            atomic<bool> stop{ false };
+            vector<vector<uint32_t>> latencies(threads);
+            vector<size_t> ops(threads);
+            vector<size_t> sinks(threads);
+            vector<std::thread> workers{};
+
+            for (size_t t = 0; t < threads; ++t) {
+                workers.emplace_back([&, t]() {
+                    auto& samples = latencies[t];
+                    size_t sink = 0;
+                    size_t i = 0;
+
+                    pin(t);
+                    samples.reserve(maxSamples);
+
+                    // Warm up before everyone starts together.
+                    for (; i < 8; ++i) {
+                        sink += fn(t, i);
+                    }
+
+                    ++ready;
+
+                    while (!go.load()) {
+                        std::this_thread::yield();
+                    }
+
+                    for (; !stop.load(memory_order_relaxed); ++i) {
+                        auto start = chrono::steady_clock::now();
+
+                        sink += fn(t, i);
+
+                        auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+
+                        if (samples.size() < maxSamples) {
+                            samples.push_back((uint32_t)min<int64_t>(elapsed, UINT32_MAX));
+                        }
+                    }
+
+                    ops[t] = i - 8;
+                    sinks[t] = sink;
+                });
+            }
+
+            while (ready.load() != threads) {
+                std::this_thread::yield();
+            }
+
+            auto start = chrono::steady_clock::now();
+
+            go = true;
+            std::this_thread::sleep_for(chrono::duration<double>(m_options.minSeconds));
+            stop = true;
+
+            for (auto& worker : workers) {
+                worker.join();
+            }
+
+            auto elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            vector<uint32_t> merged{};
+            size_t total = 0;
+
+            for (size_t t = 0; t < threads; ++t) {
+                merged.insert(merged.end(), latencies[t].begin(), latencies[t].end());
+                total += ops[t];
+                m_sink += sinks[t];
+            }
+
+            sort(merged.begin(), merged.end());
+
+            ScalingResult result{};
+
+            result.name = name;
+            result.threads = threads;
+            result.opsPerSecond = total / elapsed;
+            result.p50 = percentile(merged, 0.5);
+            result.p99 = percentile(merged, 0.99);
+            result.p999 = percentile(merged, 0.999);
+
+            if (singleThreaded == 0) {
+                singleThreaded = result.opsPerSecond / threads;
+            }
+
+            result.efficiency = result.opsPerSecond / (threads * singleThreaded);
+
+            record(result);
+        }
+    }
+
+    json Runner::report() const {
+        json benchmarks = json::array();
+
+        for (auto& result : m_results) {
+            json benchmark{
+                { "name", result.name },
+                { "iterations", result.iterations },
+                { "ns_per_op", result.nsPerOp },
+                { "bytes_per_second", result.bytesPerSecond }
+            };
+
+            if (allocationsCounted) {
+                benchmark["allocs_per_op"] = result.allocsPerOp;
+            }
+
+            benchmarks.push_back(move(benchmark));
+        }
+
+        json scaling = json::array();
+
+        for (auto& result : m_scalingResults) {
+            scaling.push_back({
+                { "name", result.name },
+                { "threads", result.threads },
+                { "ops_per_second", result.opsPerSecond },
+                { "p50_ns", result.p50 },
+                { "p99_ns", result.p99 },
+                { "p999_ns", result.p999 },
+                { "efficiency", result.efficiency }
+            });
+        }
+
+        return json{ { "benchmarks", benchmarks }, { "scaling", scaling } };
+    }
+
+    namespace {
+        // The benchmarks array of a report, or null if it hasn't got one. Reports are read from files,
+        // so nothing about their shape is taken for granted.
+        const json* benchmarksOf(const json& report) {
+            if (!report.is_object()) {
+                return nullptr;
+            }
+
+            auto it = report.find("benchmarks");
+
+            return it != report.end() && it->is_array() ? &*it : nullptr;
+        }
+
+        // Reads the name and ns_per_op of a report's benchmark. Returns false if either is missing or
+        // the wrong type, or the time isn't positive.
+        bool timing(const json& benchmark, string& name, double& ns) {
+            if (!benchmark.is_object()) {
+                return false;
+            }
+
+            auto nameIt = benchmark.find("name");
+            auto nsIt = benchmark.find("ns_per_op");
+
+            if (nameIt == benchmark.end() || !nameIt->is_string() || nsIt == benchmark.end() || !nsIt->is_number()) {
+                return false;
+            }
+
+            name = nameIt->get<string>();
+            ns = nsIt->get<double>();
+
+            return ns > 0;
+        }
+    }
+
+    json compareReports(const json& baseline, const json& report) {
+        json benchmarks = json::array();
+        double logSum = 0;
+        size_t count = 0;
+        auto baseResults = benchmarksOf(baseline);
+        auto results = benchmarksOf(report);
+
+        if (baseResults == nullptr || results == nullptr) {
+            return json{ { "benchmarks", benchmarks }, { "geomean_speedup", 0 } };
+        }
+
+        for (auto& result : *results) {
+            string name{};
+            double ns = 0;
+
+            if (!timing(result, name, ns)) {
+                continue;
+            }
+
+            for (auto& base : *baseResults) {
+                string baseName{};
+                double baseNs = 0;
+
+                if (!timing(base, baseName, baseNs) || baseName != name) {
+                    continue;
+                }
+
+                auto speedup = baseNs / ns;
+
+                cerr << left << setw(40) << name << right
+                    << setw(12) << (uint64_t)baseNs << " ns/op"
+                    << setw(12) << (uint64_t)ns << " ns/op"
+                    << setw(10) << fixed << setprecision(2) << speedup << "x" << endl;
+
+                benchmarks.push_back({
+                    { "name", name },
+                    { "baseline_ns_per_op", baseNs },
+                    { "ns_per_op", ns },
+                    { "speedup", speedup }
+                });
+
+                logSum += log(speedup);
+                ++count;
+                break;
+            }
+        }
+
+        auto geomean = count == 0 ? 0 : exp(logSum / count);
+
+        cerr << left << setw(40) << "geomean" << right << setw(44) << fixed << setprecision(2) << geomean << "x" << endl;
+
+        return json{ { "benchmarks", benchmarks }, { "geomean_speedup", geomean } };
+    }
+}
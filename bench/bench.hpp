@@ -0,0 +1,161 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "jwt/json.hpp"
+
+#ifdef JWT_BENCH_ALLOCATIONS
+#include "support/alloccount.hpp"
+#endif
+
+namespace bench {
+    // Whether allocations are counted, and this thread's allocations through operator new and
+    // OpenSSL's allocator so far. Counting replaces the allocators, so it's only built in with
+    // -Dbench_allocations=ON and otherwise stays out of the timings.
+#ifdef JWT_BENCH_ALLOCATIONS
+    const bool allocationsCounted = true;
+
+    inline size_t allocationCount() {
+        return g_allocations + g_opensslAllocations;
+    }
+#else
+    const bool allocationsCounted = false;
+
+    inline size_t allocationCount() {
+        return 0;
+    }
+#endif
+
+    struct Options {
+        // Only benchmarks with this in their name are run.
+        std::string filter{};
+
+        // Each benchmark runs for at least this long once warmed up.
+        double minSeconds{ 0.2 };
+
+        // If not 0 only the scaling benchmarks are run, on 1, 2, 4 ... up to this many threads.
+        size_t threads{ 0 };
+
+        // If set, nothing is run and the report in compare is compared with the one in baseline.
+        std::string baseline{};
+        std::string compare{};
+    };
+
+    struct Result {
+        std::string name{};
+        uint64_t iterations{ 0 };
+        double nsPerOp{ 0 };
+        double bytesPerSecond{ 0 };
+        double allocsPerOp{ 0 };
+    };
+
+    struct ScalingResult {
+        std::string name{};
+        size_t threads{ 0 };
+        double opsPerSecond{ 0 };
+        double p50{ 0 };
+        double p99{ 0 };
+        double p999{ 0 };
+
+        // Throughput relative to threads times the single threaded throughput.
+        double efficiency{ 0 };
+    };
+
+    // Options from the command line: [--filter name] [--min-time seconds] [--threads count] or
+    // --compare baseline.json report.json. Returns false if they don't parse.
+    bool parseOptions(int argc, char** argv, Options& options);
+
+    // Compares two reports, such as those of a plain and a pgo=use build, as {"benchmarks":[{"name",
+    // "baseline_ns_per_op", "ns_per_op", "speedup"}, ...], "geomean_speedup"}. Only benchmarks in both
+    // are compared, and a speedup over 1 means report is faster. Prints a table to stderr as it goes.
+    nlohmann::json compareReports(const nlohmann::json& baseline, const nlohmann::json& report);
+
+    // Times benchmarks and collects their results.
+    class Runner {
+    public:
+        explicit Runner(Options options) : m_options(std::move(options)) {}
+
+        // Runs fn until it has taken at least minSeconds. bytesPerOp is how much each call processes,
+        // for bytes/s. fn returns something derived from its work so it isn't optimized away.
+        template <typename Fn>
+        void run(const std::string& name, size_t bytesPerOp, Fn fn) {
+            if (!selected(name)) {
+                return;
+            }
+
+            // Warm up caches and the allocator, and find roughly how many calls fill minSeconds.
+            uint64_t iterations = 1;
+
+            for (;;) {
+                auto elapsed = time(iterations, fn);
+
+                if (elapsed >= m_options.minSeconds / 10 || iterations >= (1ull << 30)) {
+                    auto scale = m_options.minSeconds / (elapsed > 0 ? elapsed : 1e-9);
+
+                    iterations = (uint64_t)(iterations * (scale < 1 ? 1 : scale)) + 1;
+                    break;
+                }
+
+                iterations *= 2;
+            }
+
+            auto allocations = allocationCount();
+            auto elapsed = time(iterations, fn);
+
+            allocations = allocationCount() - allocations;
+
+            Result result{};
+
+            result.name = name;
+            result.iterations = iterations;
+            result.nsPerOp = elapsed * 1e9 / iterations;
+            result.bytesPerSecond = bytesPerOp * iterations / elapsed;
+            result.allocsPerOp = (double)allocations / iterations;
+
+            record(result);
+        }
+
+        bool selected(const std::string& name) const {
+            return name.find(m_options.filter) != std::string::npos;
+        }
+
+        void record(const Result& result);
+        void record(const ScalingResult& result);
+
+        // Runs fn on each of threadCounts threads at once for minSeconds, each thread pinned to its own
+        // core where that's supported. fn is given the thread's index and a count of its calls so far
+        // and should only read shared state. Latencies are measured per call.
+        void scale(const std::string& name, const std::vector<size_t>& threadCounts, const std::function<size_t(size_t thread, size_t i)>& fn);
+
+        const std::vector<Result>& results() const {
+            return m_results;
+        }
+
+        // The results as {"benchmarks":[{"name", "iterations", "ns_per_op", "bytes_per_second",
+        // "allocs_per_op" if allocationsCounted}, ...], "scaling":[{"name", "threads", "ops_per_second", "p50_ns", "p99_ns",
+        // "p999_ns", "efficiency"}, ...]}.
+        nlohmann::json report() const;
+
+    private:
+        template <typename Fn>
+        double time(uint64_t iterations, Fn& fn) {
+            auto start = std::chrono::steady_clock::now();
+
+            for (uint64_t i = 0; i < iterations; ++i) {
+                m_sink += fn();
+            }
+
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        Options m_options;
+        std::vector<Result> m_results{};
+        std::vector<ScalingResult> m_scalingResults{};
+        volatile size_t m_sink{ 0 };
+    };
+}
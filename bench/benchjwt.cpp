@@ -0,0 +1,326 @@
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "bench.hpp"
+#include "support/keys.hpp"
+
+#include "jwt/jwt.hpp"
+#include "jwt/claims.hpp"
+#include "jwt/projection.hpp"
+#include "jwt/backend.hpp"
+#include "jwt/json.hpp"
+
+#ifdef JWT_SIMDJSON
+#include "jwt/simdjson.hpp"
+#endif
+
+using namespace std;
+using namespace nlohmann;
+
+struct BenchClaims {
+    string sub{};
+    int64_t exp{};
+    string tenant{};
+    vector<string> aud{};
+};
+
+namespace jwt {
+    template <>
+    struct ClaimSchema<BenchClaims> {
+        template <typename Field>
+        static void fields(BenchClaims& claims, Field& field) {
+            field("sub", claims.sub, Claim::Required);
+            field("exp", claims.exp, Claim::Required);
+            field("tenant_id", claims.tenant, Claim::Optional);
+            field("aud", claims.aud, Claim::Optional);
+        }
+    };
+}
+
+void from_json(const json& j, BenchClaims& claims) {
+    claims.sub = j.at("sub").get<string>();
+    claims.exp = j.at("exp").get<int64_t>();
+
+    if (j.count("tenant_id") != 0) {
+        claims.tenant = j["tenant_id"].get<string>();
+    }
+
+    if (j.count("aud") != 0) {
+        claims.aud = j["aud"].get<vector<string>>();
+    }
+}
+
+namespace {
+    const char* const algs[] = { "none", "HS256", "HS384", "HS512", "RS256", "RS384", "RS512", "ES256", "ES384", "ES512" };
+    const size_t sizes[] = { 100, 1024, 4096, 16384, 65536 };
+
+    string sizeName(size_t size) {
+        return size < 1024 ? to_string(size) + "B" : to_string(size / 1024) + "KB";
+    }
+
+    // A payload with the claims we care about and a filler claim bringing it to about size bytes.
+    json makeSizedPayload(size_t size) {
+        json payload{
+            { "sub", "1234567890" },
+            { "exp", 1700000000 },
+            { "tenant_id", "tenant-42" },
+            { "aud", { "api", "gateway" } }
+        };
+
+        auto used = payload.dump().length() + string{ R"(,"data":"")" }.length();
+
+        payload["data"] = string(size > used ? size - used : 0, 'x');
+
+        return payload;
+    }
+
+    // A payload with a few claims we care about and a profile blob of roughly profileSize bytes we don't.
+    json makePayload(size_t profileSize) {
+        json payload{
+            { "sub", "1234567890" },
+            { "exp", 1700000000 },
+            { "tenant_id", "tenant-42" },
+            { "aud", { "api", "gateway" } }
+        };
+
+        auto& profile = payload["profile"];
+
+        profile["bio"] = string(profileSize / 2, 'x');
+        profile["history"] = json::array();
+
+        for (size_t i = 0; i < profileSize / 16; ++i) {
+            profile["history"].push_back(i);
+        }
+
+        return payload;
+    }
+
+    // Encodes and decodes a token of each size with each alg.
+    void benchAlgorithms(bench::Runner& runner) {
+        for (auto alg : algs) {
+            support::KeyPair keys{};
+
+            if (!support::makeKeyPair(alg, keys)) {
+                cerr << "skipping " << alg << ", couldn't make a key" << endl;
+                continue;
+            }
+
+            for (auto size : sizes) {
+                auto payload = makeSizedPayload(size);
+                auto token = jwt::encode(payload, keys.signing, alg);
+                auto suffix = string{ "/" } + alg + "/" + sizeName(size);
+
+                runner.run("encode" + suffix, token.length(), [&]() {
+                    return jwt::encode(payload, keys.signing, alg).length();
+                });
+
+                runner.run("decode" + suffix, token.length(), [&]() {
+                    return jwt::decode(token, keys.verifying, { alg }).size();
+                });
+            }
+        }
+    }
+
+    // The pieces decode and encode are built from, on their own.
+    void benchStages(bench::Runner& runner) {
+        for (auto size : sizes) {
+            string data(size, '\0');
+
+            for (size_t i = 0; i < size; ++i) {
+                data[i] = (char)(i * 131 + 7);
+            }
+
+            auto encoded = jwt::detail::b64encode((const uint8_t*)data.data(), data.size());
+
+            runner.run("b64encode/" + sizeName(size), size, [&]() {
+                return jwt::detail::b64encode((const uint8_t*)data.data(), data.size()).length();
+            });
+
+            runner.run("b64decode/" + sizeName(size), size, [&]() {
+                return jwt::detail::b64decode(encoded).size();
+            });
+        }
+
+        for (auto alg : algs) {
+            support::KeyPair keys{};
+            string name{ alg };
+
+            if (name == "none" || !support::makeKeyPair(alg, keys)) {
+                continue;
+            }
+
+            for (auto size : sizes) {
+                string message(size, 'x');
+                auto suffix = "/" + name + "/" + sizeName(size);
+
+                if (name.compare(0, 2, "HS") == 0) {
+                    runner.run("signHMAC" + suffix, size, [&]() {
+                        return jwt::detail::signHMAC(message, keys.signing, name).length();
+                    });
+
+                    continue;
+                }
+
+                auto signature = jwt::detail::signPEM(message, keys.signing, name);
+
+                runner.run("signPEM" + suffix, size, [&]() {
+                    return jwt::detail::signPEM(message, keys.signing, name).length();
+                });
+
+                runner.run("verifyPEM" + suffix, size, [&]() {
+                    return (size_t)jwt::detail::verifyPEM(message, signature, keys.verifying, name);
+                });
+            }
+        }
+    }
+
+    // Decodes and encodes a fixed corpus of tokens with each alg on more and more threads at once, to
+    // show contention in OpenSSL and the allocator.
+    void benchScaling(bench::Runner& runner, size_t maxThreads) {
+        constexpr size_t corpusSize = 64;
+        vector<size_t> threadCounts{};
+
+        for (size_t threads = 1; threads < maxThreads; threads *= 2) {
+            threadCounts.push_back(threads);
+        }
+
+        threadCounts.push_back(maxThreads);
+
+        for (auto alg : algs) {
+            support::KeyPair keys{};
+            vector<json> payloads{};
+            vector<string> tokens{};
+
+            if (!support::makeKeyPair(alg, keys)) {
+                cerr << "skipping " << alg << ", couldn't make a key" << endl;
+                continue;
+            }
+
+            for (size_t i = 0; i < corpusSize; ++i) {
+                auto payload = makeSizedPayload(1024);
+
+                payload["sub"] = to_string(i);
+                tokens.push_back(jwt::encode(payload, keys.signing, alg));
+                payloads.push_back(move(payload));
+            }
+
+            // Threads start at different points in the corpus so they aren't in lockstep.
+            runner.scale(string{ "scale/decode/" } + alg, threadCounts, [&](size_t thread, size_t i) {
+                return jwt::decode(tokens[(thread * 7 + i) % corpusSize], keys.verifying, { alg }).size();
+            });
+
+            runner.scale(string{ "scale/encode/" } + alg, threadCounts, [&](size_t thread, size_t i) {
+                return jwt::encode(payloads[(thread * 7 + i) % corpusSize], keys.signing, alg).length();
+            });
+        }
+    }
+
+    void benchClaims(bench::Runner& runner) {
+        string key{ "secret" };
+        jwt::Projection projection{ "/sub", "/exp", "/tenant_id" };
+
+        for (size_t size : { 0, 1024, 16384 }) {
+            auto token = jwt::encode(makePayload(size), key, "HS256");
+            auto suffix = "/" + sizeName(token.length());
+
+            runner.run("decode+from_json" + suffix, token.length(), [&]() {
+                auto claims = jwt::decode(token, key).get<BenchClaims>();
+                return claims.sub.length();
+            });
+
+            runner.run("decode<Claims>" + suffix, token.length(), [&]() {
+                BenchClaims claims{};
+                jwt::decode(token, key, claims);
+                return claims.sub.length();
+            });
+
+            runner.run("decode(Projection)" + suffix, token.length(), [&]() {
+                jwt::ProjectedClaims claims{};
+                jwt::decode(token, key, projection, claims);
+                return claims[0].size();
+            });
+        }
+    }
+
+    // Parses the whole payload with each json backend and reads the same few claims back.
+    void benchBackends(bench::Runner& runner) {
+        string key{ "secret" };
+        jwt::NlohmannBackend nlohmannBackend{};
+#ifdef JWT_SIMDJSON
+        jwt::SimdjsonBackend simdjsonBackend{};
+#endif
+
+        for (size_t size : { 0, 1024, 4096, 16384, 65536 }) {
+            auto token = jwt::encode(makePayload(size), key, "HS256");
+            auto suffix = "/" + sizeName(token.length());
+
+            runner.run("backend<nlohmann>" + suffix, token.length(), [&]() {
+                json payload{};
+                jwt::decode(token, key, nlohmannBackend, payload);
+                return payload["sub"].get_ref<const string&>().length() + (size_t)payload["exp"].get<int64_t>();
+            });
+
+#ifdef JWT_SIMDJSON
+            runner.run("backend<simdjson>" + suffix, token.length(), [&]() {
+                jwt::SimdjsonBackend::Document payload{};
+                jwt::decode(token, key, simdjsonBackend, payload);
+
+                std::string_view sub{};
+                int64_t exp{};
+
+                if (payload["sub"].get_string().get(sub) != simdjson::SUCCESS || payload["exp"].get_int64().get(exp) != simdjson::SUCCESS) {
+                    return (size_t)0;
+                }
+
+                return sub.length() + (size_t)exp;
+            });
+#endif
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    bench::Options options{};
+
+    if (!bench::parseOptions(argc, argv, options)) {
+        cerr << "usage: bench_jwt [--filter name] [--min-time seconds] [--threads count]\n"
+            << "       bench_jwt --compare baseline.json report.json" << endl;
+        return 1;
+    }
+
+    // Saved reports from two builds, such as one without pgo and one with pgo=use.
+    if (!options.compare.empty()) {
+        ifstream baseline{ options.baseline };
+        ifstream report{ options.compare };
+        auto baselineReport = json::parse(baseline, nullptr, false);
+        auto compareReport = json::parse(report, nullptr, false);
+
+        if (baselineReport.is_discarded() || compareReport.is_discarded()) {
+            cerr << "couldn't read reports from " << options.baseline << " and " << options.compare << endl;
+            return 1;
+        }
+
+        cout << bench::compareReports(baselineReport, compareReport).dump(4) << endl;
+
+        return 0;
+    }
+
+    bench::Runner runner{ options };
+
+    if (options.threads != 0) {
+        benchScaling(runner, options.threads);
+    }
+    else {
+        benchAlgorithms(runner);
+        benchStages(runner);
+        benchClaims(runner);
+        benchBackends(runner);
+    }
+
+    cout << runner.report().dump(4) << endl;
+
+    return 0;
+}
@@ -0,0 +1,493 @@
+#include <cmath>
+#include <fstream>
+#include <unordered_map>
+
+#include "corpus.hpp"
+
+#include "jwt/jwt.hpp"
+#include "jwt/capture.hpp"
+#include "jwt/json.hpp"
+
+using namespace std;
+using namespace nlohmann;
+
+namespace bench {
+    namespace {
+        const char corpusMagic[4] = { 'J', 'W', 'T', 'C' };
+        constexpr uint32_t corpusVersion = 1;
+        constexpr uint8_t repeatTag = 0xff;
+
+        const char base64url[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+        // splitmix64, so a seed gives the same corpus whatever the standard library.
+        class Random {
+        public:
+            explicit Random(uint64_t seed) : m_state{ seed } {}
+
+            uint64_t next() {
+                auto z = (m_state += 0x9e3779b97f4a7c15ull);
+
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+
+                return z ^ (z >> 31);
+            }
+
+            // In [0, 1).
+            double uniform() {
+                return (next() >> 11) / 9007199254740992.0;
+            }
+
+            size_t below(size_t n) {
+                return n == 0 ? 0 : (size_t)(next() % n);
+            }
+
+            // An index into weights, picked in proportion to them.
+            size_t pick(const vector<double>& weights) {
+                double total = 0;
+
+                for (auto weight : weights) {
+                    total += weight;
+                }
+
+                auto target = uniform() * total;
+
+                for (size_t i = 0; i < weights.size(); ++i) {
+                    if (target < weights[i]) {
+                        return i;
+                    }
+
+                    target -= weights[i];
+                }
+
+                return weights.size() - 1;
+            }
+
+        private:
+            uint64_t m_state;
+        };
+
+        string encodeSegment(const string& value) {
+            return jwt::detail::b64encode((const uint8_t*)value.data(), value.length());
+        }
+
+        // Signs the header and payload as they are. Returns an empty string on failure.
+        string sign(const CorpusKey& key, const string& header, const string& payload) {
+            auto token = encodeSegment(header) + '.' + encodeSegment(payload);
+            string signature{};
+
+            if (key.alg.compare(0, 2, "HS") == 0) {
+                signature = jwt::detail::signHMAC(token, key.keys.signing, key.alg);
+            }
+            else if (key.alg != "none") {
+                signature = jwt::detail::signPEM(token, key.keys.signing, key.alg);
+            }
+
+            if (key.alg != "none" && signature.empty()) {
+                return string{};
+            }
+
+            return token + '.' + signature;
+        }
+
+        // Like jwt::encode but with a kid in the header.
+        string sign(const CorpusKey& key, const json& payload) {
+            json header{
+                { "typ", "JWT" },
+                { "alg", key.alg },
+                { "kid", key.kid }
+            };
+
+            return sign(key, header.dump(), payload.dump());
+        }
+
+        json makePayload(Random& random, size_t size, int64_t exp) {
+            json payload{
+                { "sub", "user-" + to_string(random.below(100000)) },
+                { "iat", exp - 3600 },
+                { "exp", exp },
+                { "tenant_id", "tenant-" + to_string(random.below(100)) },
+                { "aud", { "api", "gateway" } }
+            };
+
+            auto used = payload.dump().length() + string{ R"(,"data":"")" }.length();
+            string data{};
+
+            for (; used < size; ++used) {
+                data += base64url[random.below(64)];
+            }
+
+            payload["data"] = data;
+
+            return payload;
+        }
+
+        // Swaps a character in the middle of the signature, which always changes the bytes it decodes to.
+        void tamper(Random& random, string& token) {
+            auto signature = token.rfind('.') + 1;
+            auto pos = signature + (token.length() - signature) / 2;
+            auto replacement = base64url[random.below(64)];
+
+            token[pos] = replacement != token[pos] ? replacement : (token[pos] == 'A' ? 'B' : 'A');
+        }
+
+        void malform(Random& random, string& token) {
+            switch (random.below(4)) {
+            case 0:
+                // No signature segment.
+                token.erase(token.rfind('.'));
+                break;
+            case 1:
+                // Not base64url.
+                token.insert(random.below(token.find('.')), "!");
+                break;
+            case 2:
+                // A header that isn't json.
+                token.replace(0, token.find('.'), "bm90IGpzb24");
+                break;
+            default:
+                token.resize(random.below(token.length()));
+                break;
+            }
+        }
+
+        void put32(string& out, uint32_t value) {
+            for (int i = 0; i < 4; ++i) {
+                out += (char)((value >> (i * 8)) & 0xff);
+            }
+        }
+
+        void putString(string& out, const string& value) {
+            put32(out, (uint32_t)value.length());
+            out += value;
+        }
+
+        class Reader {
+        public:
+            explicit Reader(const string& data) : m_data(data) {}
+
+            bool skip(size_t count) {
+                if (count > m_data.length() - m_pos) {
+                    return false;
+                }
+
+                m_pos += count;
+                return true;
+            }
+
+            bool get8(uint8_t& value) {
+                if (m_pos + 1 > m_data.length()) {
+                    return false;
+                }
+
+                value = (uint8_t)m_data[m_pos++];
+                return true;
+            }
+
+            bool get32(uint32_t& value) {
+                if (m_pos + 4 > m_data.length()) {
+                    return false;
+                }
+
+                value = 0;
+
+                for (int i = 0; i < 4; ++i) {
+                    value |= (uint32_t)(uint8_t)m_data[m_pos++] << (i * 8);
+                }
+
+                return true;
+            }
+
+            bool getString(string& value) {
+                uint32_t length{};
+
+                if (!get32(length) || length > m_data.length() - m_pos) {
+                    return false;
+                }
+
+                value = m_data.substr(m_pos, length);
+                m_pos += length;
+                return true;
+            }
+
+            bool done() const {
+                return m_pos == m_data.length();
+            }
+
+        private:
+            const string& m_data;
+            size_t m_pos{ 0 };
+        };
+    }
+
+    bool generateCorpus(const CorpusOptions& options, Corpus& corpus) {
+        if (options.algs.empty() || options.keysPerAlg == 0 || options.minPayload > options.maxPayload) {
+            return false;
+        }
+
+        Random random{ options.seed };
+
+        corpus = Corpus{};
+
+        vector<double> algWeights{};
+        vector<double> kidWeights{};
+
+        for (auto& alg : options.algs) {
+            if (jwt::algFromName(alg.first) == jwt::Alg::Unknown) {
+                return false;
+            }
+
+            for (size_t k = 0; k < options.keysPerAlg; ++k) {
+                CorpusKey key{};
+
+                key.alg = alg.first;
+                key.kid = alg.first + "-" + to_string(k);
+
+                if (!support::makeKeyPair(key.alg, key.keys)) {
+                    return false;
+                }
+
+                corpus.keys.push_back(move(key));
+            }
+
+            algWeights.push_back(alg.second);
+        }
+
+        for (size_t k = 0; k < options.keysPerAlg; ++k) {
+            kidWeights.push_back(1 / pow((double)(k + 1), options.kidSkew));
+        }
+
+        auto minLog = log((double)(options.minPayload == 0 ? 1 : options.minPayload));
+        auto maxLog = log((double)(options.maxPayload == 0 ? 1 : options.maxPayload));
+
+        for (size_t i = 0; i < options.count; ++i) {
+            if (!corpus.tokens.empty() && random.uniform() < options.repeatRate) {
+                corpus.tokens.push_back(corpus.tokens[random.below(corpus.tokens.size())]);
+                continue;
+            }
+
+            CorpusToken token{};
+
+            token.key = (uint32_t)(random.pick(algWeights) * options.keysPerAlg + random.pick(kidWeights));
+
+            auto& key = corpus.keys[token.key];
+            auto roll = random.uniform();
+
+            // A none token can't carry a bad signature, so those stay valid.
+            if (roll < options.malformedFraction) {
+                token.kind = TokenKind::Malformed;
+            }
+            else if ((roll -= options.malformedFraction) < options.invalidFraction && key.alg != "none") {
+                token.kind = TokenKind::Invalid;
+            }
+            else if ((roll -= options.invalidFraction) < options.expiredFraction) {
+                token.kind = TokenKind::Expired;
+            }
+
+            auto size = (size_t)exp(minLog + random.uniform() * (maxLog - minLog));
+            auto payload = makePayload(random, size, token.kind == TokenKind::Expired ? 1000000000 : corpusValidExp);
+
+            token.token = sign(key, payload);
+
+            if (token.token.empty()) {
+                return false;
+            }
+
+            if (token.kind == TokenKind::Invalid) {
+                tamper(random, token.token);
+            }
+            else if (token.kind == TokenKind::Malformed) {
+                malform(random, token.token);
+            }
+
+            corpus.tokens.push_back(move(token));
+        }
+
+        return true;
+    }
+
+    bool importCapture(const vector<jwt::CapturedToken>& captured, Corpus& corpus) {
+        Random random{ 1 };
+        unordered_map<string, uint32_t> keys{};
+        unordered_map<uint32_t, size_t> seen{};
+
+        corpus = Corpus{};
+
+        // Finds or makes the test key standing in for a production one.
+        auto keyFor = [&](const string& alg, const string& kid, uint32_t& index) {
+            auto found = keys.find(alg + '\0' + kid);
+
+            if (found != keys.end()) {
+                index = found->second;
+                return true;
+            }
+
+            CorpusKey key{};
+
+            key.alg = alg;
+            key.kid = kid;
+
+            if (!support::makeKeyPair(alg, key.keys)) {
+                return false;
+            }
+
+            index = (uint32_t)corpus.keys.size();
+            keys.emplace(alg + '\0' + kid, index);
+            corpus.keys.push_back(move(key));
+
+            return true;
+        };
+
+        for (auto& sample : captured) {
+            auto repeat = seen.find(sample.tokenHash);
+
+            if (repeat != seen.end()) {
+                corpus.tokens.push_back(corpus.tokens[repeat->second]);
+                continue;
+            }
+
+            CorpusToken token{};
+            auto header = json::parse(sample.header, nullptr, false);
+            auto signable = sample.alg != jwt::Alg::Unknown && header.is_object() && !sample.payload.empty();
+
+            if (signable && (sample.outcome == jwt::Outcome::Ok || sample.outcome == jwt::Outcome::BadSignature)) {
+                auto kid = header["kid"].is_string() ? header["kid"].get<string>() : string{};
+
+                if (!keyFor(jwt::algName(sample.alg), kid, token.key)) {
+                    return false;
+                }
+
+                token.token = sign(corpus.keys[token.key], sample.header, sample.payload);
+
+                if (token.token.empty()) {
+                    return false;
+                }
+
+                if (sample.outcome == jwt::Outcome::BadSignature && sample.alg != jwt::Alg::None) {
+                    token.kind = TokenKind::Invalid;
+                    tamper(random, token.token);
+                }
+            }
+            else {
+                // Anything else failed before its signature counted, so garbage of the same size fails
+                // the same way.
+                if (!keyFor("HS256", "", token.key)) {
+                    return false;
+                }
+
+                token.kind = TokenKind::Malformed;
+                token.token = string(sample.tokenSize, 'x');
+            }
+
+            seen.emplace(sample.tokenHash, corpus.tokens.size());
+            corpus.tokens.push_back(move(token));
+        }
+
+        return true;
+    }
+
+    bool writeCorpus(const string& path, const Corpus& corpus) {
+        string out{ corpusMagic, sizeof(corpusMagic) };
+
+        put32(out, corpusVersion);
+        put32(out, (uint32_t)corpus.keys.size());
+
+        for (auto& key : corpus.keys) {
+            putString(out, key.alg);
+            putString(out, key.kid);
+            putString(out, key.keys.signing);
+            putString(out, key.keys.verifying);
+        }
+
+        // Repeats are written as the index of the token's first appearance.
+        unordered_map<string, uint32_t> first{};
+
+        put32(out, (uint32_t)corpus.tokens.size());
+
+        for (uint32_t i = 0; i < corpus.tokens.size(); ++i) {
+            auto& token = corpus.tokens[i];
+            auto inserted = first.emplace(token.token, i);
+
+            if (!inserted.second) {
+                out += (char)repeatTag;
+                put32(out, inserted.first->second);
+                continue;
+            }
+
+            out += (char)token.kind;
+            put32(out, token.key);
+            putString(out, token.token);
+        }
+
+        ofstream file{ path, ios::binary };
+
+        return file.write(out.data(), out.length()) && file.flush();
+    }
+
+    bool readCorpus(const string& path, Corpus& corpus) {
+        ifstream file{ path, ios::binary };
+
+        if (!file) {
+            return false;
+        }
+
+        string data{ istreambuf_iterator<char>{ file }, istreambuf_iterator<char>{} };
+
+        if (data.compare(0, sizeof(corpusMagic), corpusMagic, sizeof(corpusMagic)) != 0) {
+            return false;
+        }
+
+        Reader reader{ data };
+        uint32_t version{};
+        uint32_t count{};
+
+        if (!reader.skip(sizeof(corpusMagic)) || !reader.get32(version) || version != corpusVersion || !reader.get32(count)) {
+            return false;
+        }
+
+        corpus = Corpus{};
+
+        for (uint32_t i = 0; i < count; ++i) {
+            CorpusKey key{};
+
+            if (!reader.getString(key.alg) || !reader.getString(key.kid) || !reader.getString(key.keys.signing) || !reader.getString(key.keys.verifying)) {
+                return false;
+            }
+
+            corpus.keys.push_back(move(key));
+        }
+
+        if (!reader.get32(count)) {
+            return false;
+        }
+
+        for (uint32_t i = 0; i < count; ++i) {
+            CorpusToken token{};
+            uint8_t kind{};
+
+            if (!reader.get8(kind)) {
+                return false;
+            }
+
+            if (kind == repeatTag) {
+                uint32_t index{};
+
+                if (!reader.get32(index) || index >= corpus.tokens.size()) {
+                    return false;
+                }
+
+                corpus.tokens.push_back(corpus.tokens[index]);
+                continue;
+            }
+
+            if (kind > (uint8_t)TokenKind::Malformed || !reader.get32(token.key) || token.key >= corpus.keys.size() || !reader.getString(token.token)) {
+                return false;
+            }
+
+            token.kind = (TokenKind)kind;
+            corpus.tokens.push_back(move(token));
+        }
+
+        return reader.done();
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "support/keys.hpp"
+
+#include "jwt/capture.hpp"
+
+namespace bench {
+    // What decoding a corpus token should do.
+    enum class TokenKind : uint8_t {
+        Valid,
+        // Signed, but its signature doesn't match.
+        Invalid,
+        // Signed properly, but its exp is long past.
+        Expired,
+        // Not a well formed jwt at all.
+        Malformed
+    };
+
+    struct CorpusKey {
+        std::string alg{};
+        std::string kid{};
+        support::KeyPair keys{};
+    };
+
+    struct CorpusToken {
+        TokenKind kind{ TokenKind::Valid };
+
+        // The key it was signed with, or claims to be.
+        uint32_t key{ 0 };
+        std::string token{};
+    };
+
+    struct Corpus {
+        std::vector<CorpusKey> keys{};
+        std::vector<CorpusToken> tokens{};
+    };
+
+    struct CorpusOptions {
+        uint64_t seed{ 1 };
+        size_t count{ 10000 };
+
+        // The algs tokens are signed with and their relative weights.
+        std::vector<std::pair<std::string, double>> algs{ { "HS256", 5 }, { "RS256", 3 }, { "ES256", 2 } };
+
+        // Each alg gets this many keys, each with its own kid.
+        size_t keysPerAlg{ 4 };
+
+        // Key k of an alg signs with weight 1 / (k + 1)^kidSkew, so 0 uses them all evenly.
+        double kidSkew{ 1.0 };
+
+        // Payload sizes are spread log-uniformly between these.
+        size_t minPayload{ 128 };
+        size_t maxPayload{ 4096 };
+
+        double invalidFraction{ 0.05 };
+        double expiredFraction{ 0.05 };
+        double malformedFraction{ 0.02 };
+
+        // The fraction of tokens that repeat an earlier one, as clients reusing their token do.
+        double repeatRate{ 0.5 };
+    };
+
+    // The exp of valid tokens, and a cutoff for telling expired ones apart: 2100-01-01.
+    constexpr int64_t corpusValidExp = 4102444800;
+
+    // Generates a corpus. The same options always give the same mix of tokens, claims and sizes, but
+    // keys and ES signatures are fresh every time, so replay the written file to repeat a run.
+    // Returns false on failure.
+    bool generateCorpus(const CorpusOptions& options, Corpus& corpus);
+
+    // Turns samples from a jwt::TrafficCapture into a corpus with the same headers, payload shapes,
+    // repeats and outcomes, signed with fresh test keys standing in for each alg and kid. Tokens that
+    // failed for any reason other than their signature become malformed ones of the same size.
+    // Returns false on failure.
+    bool importCapture(const std::vector<jwt::CapturedToken>& captured, Corpus& corpus);
+
+    // The file is "JWTC", a version, then the keys and tokens, with little endian length prefixes.
+    // A repeated token is stored once and referred to by index after that. Both return false on
+    // failure.
+    bool writeCorpus(const std::string& path, const Corpus& corpus);
+    bool readCorpus(const std::string& path, Corpus& corpus);
+}
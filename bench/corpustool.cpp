@@ -0,0 +1,309 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "corpus.hpp"
+
+#include "jwt/jwt.hpp"
+#include "jwt/cache.hpp"
+#include "jwt/capture.hpp"
+#include "jwt/metrics.hpp"
+#include "jwt/json.hpp"
+
+using namespace std;
+using namespace nlohmann;
+
+namespace {
+    const char* const kindNames[] = { "valid", "invalid", "expired", "malformed" };
+
+    void usage() {
+        cerr << "usage: jwt_corpus generate file [--seed n] [--count n] [--algs HS256:5,RS256:3,...] [--keys n]\n"
+            << "                  [--kid-skew s] [--min-payload bytes] [--max-payload bytes] [--invalid fraction]\n"
+            << "                  [--expired fraction] [--malformed fraction] [--repeat fraction]\n"
+            << "       jwt_corpus import capture file\n"
+            << "       jwt_corpus replay file [--rate per-second] [--seconds s] [--cache capacity]" << endl;
+    }
+
+    // "HS256:5,RS256:3" into algs and their weights.
+    bool parseAlgs(const string& text, vector<pair<string, double>>& algs) {
+        algs.clear();
+
+        size_t begin = 0;
+
+        while (begin < text.length()) {
+            auto end = text.find(',', begin);
+
+            if (end == string::npos) {
+                end = text.length();
+            }
+
+            auto item = text.substr(begin, end - begin);
+            auto colon = item.find(':');
+
+            algs.emplace_back(item.substr(0, colon), colon == string::npos ? 1.0 : atof(item.c_str() + colon + 1));
+            begin = end + 1;
+        }
+
+        return !algs.empty();
+    }
+
+    int generate(const string& path, int argc, char** argv) {
+        bench::CorpusOptions options{};
+
+        for (int i = 0; i < argc; ++i) {
+            if (i + 1 == argc) {
+                usage();
+                return 1;
+            }
+
+            string name{ argv[i] };
+            const char* value = argv[++i];
+
+            if (name == "--seed") {
+                options.seed = strtoull(value, nullptr, 10);
+            }
+            else if (name == "--count") {
+                options.count = strtoul(value, nullptr, 10);
+            }
+            else if (name == "--algs") {
+                if (!parseAlgs(value, options.algs)) {
+                    usage();
+                    return 1;
+                }
+            }
+            else if (name == "--keys") {
+                options.keysPerAlg = strtoul(value, nullptr, 10);
+            }
+            else if (name == "--kid-skew") {
+                options.kidSkew = atof(value);
+            }
+            else if (name == "--min-payload") {
+                options.minPayload = strtoul(value, nullptr, 10);
+            }
+            else if (name == "--max-payload") {
+                options.maxPayload = strtoul(value, nullptr, 10);
+            }
+            else if (name == "--invalid") {
+                options.invalidFraction = atof(value);
+            }
+            else if (name == "--expired") {
+                options.expiredFraction = atof(value);
+            }
+            else if (name == "--malformed") {
+                options.malformedFraction = atof(value);
+            }
+            else if (name == "--repeat") {
+                options.repeatRate = atof(value);
+            }
+            else {
+                usage();
+                return 1;
+            }
+        }
+
+        bench::Corpus corpus{};
+
+        if (!bench::generateCorpus(options, corpus)) {
+            cerr << "couldn't generate a corpus from those options" << endl;
+            return 1;
+        }
+
+        if (!bench::writeCorpus(path, corpus)) {
+            cerr << "couldn't write " << path << endl;
+            return 1;
+        }
+
+        cerr << "wrote " << corpus.tokens.size() << " tokens and " << corpus.keys.size() << " keys to " << path << endl;
+
+        return 0;
+    }
+
+    // Turns a jwt::TrafficCapture file into a corpus that can be replayed.
+    int import(const string& capturePath, const string& path) {
+        vector<jwt::CapturedToken> captured{};
+        bench::Corpus corpus{};
+
+        if (!jwt::readCapture(capturePath, captured)) {
+            cerr << "couldn't read a capture from " << capturePath << endl;
+            return 1;
+        }
+
+        if (!bench::importCapture(captured, corpus) || !bench::writeCorpus(path, corpus)) {
+            cerr << "couldn't write " << path << endl;
+            return 1;
+        }
+
+        cerr << "wrote " << corpus.tokens.size() << " tokens and " << corpus.keys.size() << " keys to " << path << endl;
+
+        return 0;
+    }
+
+    json latencyReport(const jwt::LatencyHistogram& histogram) {
+        return json{
+            { "count", histogram.count() },
+            { "mean_ns", histogram.count() == 0 ? 0 : histogram.sum() / histogram.count() },
+            { "p50_ns", histogram.percentile(0.5) },
+            { "p99_ns", histogram.percentile(0.99) },
+            { "p999_ns", histogram.percentile(0.999) },
+            { "max_ns", histogram.percentile(1) }
+        };
+    }
+
+    // Decodes the corpus in order, over and over for at least seconds if that's given. With a rate
+    // calls are issued on a fixed schedule, and latency is measured from when each call was due so
+    // falling behind shows up in it rather than hiding. Service time is measured from when each
+    // call actually started.
+    int replay(const string& path, int argc, char** argv) {
+        double rate = 0;
+        double seconds = 0;
+        size_t cacheCapacity = 0;
+
+        for (int i = 0; i < argc; ++i) {
+            if (i + 1 == argc) {
+                usage();
+                return 1;
+            }
+
+            string name{ argv[i] };
+            const char* value = argv[++i];
+
+            if (name == "--rate") {
+                rate = atof(value);
+            }
+            else if (name == "--seconds") {
+                seconds = atof(value);
+            }
+            else if (name == "--cache") {
+                cacheCapacity = strtoul(value, nullptr, 10);
+            }
+            else {
+                usage();
+                return 1;
+            }
+        }
+
+        bench::Corpus corpus{};
+
+        if (!bench::readCorpus(path, corpus) || corpus.tokens.empty()) {
+            cerr << "couldn't read a corpus from " << path << endl;
+            return 1;
+        }
+
+        // Resolving keys by kid is what a server would do, and it's what the cache is for.
+        jwt::HeaderCache cache{ [&](const string& kid, jwt::Alg alg, string& key) {
+            for (auto& candidate : corpus.keys) {
+                if (candidate.kid == kid && jwt::algFromName(candidate.alg) == alg) {
+                    key = candidate.keys.verifying;
+                    return true;
+                }
+            }
+
+            return false;
+        }, cacheCapacity == 0 ? 1 : cacheCapacity };
+
+        jwt::LatencyHistogram latency{};
+        jwt::LatencyHistogram service{};
+        size_t decoded[4]{};
+        size_t seen[4]{};
+        size_t mismatches = 0;
+
+        auto period = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(rate > 0 ? 1 / rate : 0));
+        auto start = chrono::steady_clock::now();
+        auto due = start;
+        size_t calls = 0;
+
+        for (;; ++calls) {
+            if (calls >= corpus.tokens.size() && chrono::duration<double>(chrono::steady_clock::now() - start).count() >= seconds) {
+                break;
+            }
+
+            auto& token = corpus.tokens[calls % corpus.tokens.size()];
+
+            if (rate > 0) {
+                due += period;
+
+                while (chrono::steady_clock::now() < due) {
+                    this_thread::yield();
+                }
+            }
+
+            auto began = chrono::steady_clock::now();
+            json payload{};
+
+            // decode throws on headers and payloads that aren't json.
+            try {
+                payload = cacheCapacity != 0
+                    ? jwt::decode(token.token, cache)
+                    : jwt::decode(token.token, corpus.keys[token.key].keys.verifying);
+            }
+            catch (const json::exception&) {
+            }
+
+            auto finished = chrono::steady_clock::now();
+
+            service.record((uint64_t)chrono::duration_cast<chrono::nanoseconds>(finished - began).count());
+            latency.record((uint64_t)chrono::duration_cast<chrono::nanoseconds>(finished - (rate > 0 ? due : began)).count());
+
+            // The library doesn't check exp, so expired tokens decode and it's on us to notice.
+            auto kind = (size_t)token.kind;
+            auto ok = payload.is_object();
+            auto expired = ok && payload["exp"].is_number() && payload["exp"].get<int64_t>() < bench::corpusValidExp;
+
+            ++seen[kind];
+            decoded[kind] += ok ? 1 : 0;
+
+            if (ok != (token.kind == bench::TokenKind::Valid || token.kind == bench::TokenKind::Expired) || expired != (token.kind == bench::TokenKind::Expired)) {
+                ++mismatches;
+            }
+        }
+
+        auto elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        json kinds = json::object();
+
+        for (size_t i = 0; i < 4; ++i) {
+            kinds[kindNames[i]] = json{ { "count", seen[i] }, { "decoded", decoded[i] } };
+        }
+
+        json report{
+            { "calls", calls },
+            { "seconds", elapsed },
+            { "target_rate", rate },
+            { "achieved_rate", calls / elapsed },
+            { "latency", latencyReport(latency) },
+            { "service", latencyReport(service) },
+            { "kinds", kinds },
+            { "mismatches", mismatches }
+        };
+
+        if (cacheCapacity != 0) {
+            report["cache"] = json{ { "hits", cache.hits() }, { "misses", cache.misses() } };
+        }
+
+        cout << report.dump(4) << endl;
+
+        return mismatches == 0 ? 0 : 2;
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        usage();
+        return 1;
+    }
+
+    if (strcmp(argv[1], "generate") == 0) {
+        return generate(argv[2], argc - 3, argv + 3);
+    }
+    else if (strcmp(argv[1], "import") == 0 && argc == 4) {
+        return import(argv[2], argv[3]);
+    }
+    else if (strcmp(argv[1], "replay") == 0) {
+        return replay(argv[2], argc - 3, argv + 3);
+    }
+
+    usage();
+    return 1;
+}
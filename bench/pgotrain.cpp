@@ -0,0 +1,145 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "corpus.hpp"
+
+#include "jwt/jwt.hpp"
+#include "jwt/cache.hpp"
+#include "jwt/json.hpp"
+
+using namespace std;
+using namespace nlohmann;
+
+// The workload a library built with -Dpgo=generate is trained on, so the profile it leaves reflects
+// what servers do with it rather than what the tests poke at. It decodes a corpus, the default
+// generated one or a file such as one imported from a capture, a few times over through each of
+// the ways there are to decode, and re-encodes every tenth valid token. The corpus's mix of algs,
+// payload sizes, repeats and bad tokens carries through to the profile.
+namespace {
+    void usage() {
+        cerr << "usage: pgo_train [--corpus file] [--rounds n]" << endl;
+    }
+
+    // Which of the decode entry points a call goes through, in the proportions servers use them:
+    // mostly plain decode and the kid cache, with verify and limits the rest of the time.
+    enum class Entry {
+        Decode,
+        Cache,
+        Verify,
+        Limits
+    };
+
+    Entry entryFor(size_t i) {
+        switch (i % 8) {
+        case 0:
+        case 1:
+        case 2:
+            return Entry::Decode;
+        case 3:
+        case 4:
+        case 5:
+            return Entry::Cache;
+        case 6:
+            return Entry::Verify;
+        default:
+            return Entry::Limits;
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    string path{};
+    size_t rounds = 3;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--corpus") == 0 && i + 1 < argc) {
+            path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc) {
+            rounds = strtoul(argv[++i], nullptr, 10);
+        }
+        else {
+            usage();
+            return 1;
+        }
+    }
+
+    bench::Corpus corpus{};
+    bench::CorpusOptions options{};
+
+    options.count = 5000;
+
+    if (path.empty() ? !bench::generateCorpus(options, corpus) : !bench::readCorpus(path, corpus) || corpus.tokens.empty()) {
+        cerr << "couldn't " << (path.empty() ? "generate a corpus" : "read a corpus from " + path) << endl;
+        return 1;
+    }
+
+    jwt::HeaderCache cache{ [&](const string& kid, jwt::Alg alg, string& key) {
+        for (auto& candidate : corpus.keys) {
+            if (candidate.kid == kid && jwt::algFromName(candidate.alg) == alg) {
+                key = candidate.keys.verifying;
+                return true;
+            }
+        }
+
+        return false;
+    } };
+
+    jwt::Limits limits{};
+    size_t decoded = 0;
+    size_t encoded = 0;
+    size_t calls = 0;
+
+    auto start = chrono::steady_clock::now();
+
+    for (size_t round = 0; round < rounds; ++round) {
+        for (auto& token : corpus.tokens) {
+            auto& key = corpus.keys[token.key];
+            json payload{};
+
+            // decode throws on headers and payloads that aren't json.
+            try {
+                switch (entryFor(calls++)) {
+                case Entry::Decode:
+                    payload = jwt::decode(token.token, key.keys.verifying);
+                    break;
+                case Entry::Cache:
+                    payload = jwt::decode(token.token, cache);
+                    break;
+                case Entry::Verify:
+                    decoded += jwt::verify(token.token, key.keys.verifying) == jwt::VerifyStatus::Ok ? 1 : 0;
+                    break;
+                case Entry::Limits: {
+                    jwt::VerifyStatus status{};
+
+                    payload = jwt::decode(token.token, key.keys.verifying, limits, status);
+                    break;
+                }
+                }
+            }
+            catch (const json::exception&) {
+            }
+
+            if (!payload.is_object()) {
+                continue;
+            }
+
+            ++decoded;
+
+            // Issuing is rarer than checking, but it's on the same servers.
+            if (token.kind == bench::TokenKind::Valid && decoded % 10 == 0) {
+                encoded += jwt::encode(payload, key.keys.signing, key.alg).empty() ? 0 : 1;
+            }
+        }
+    }
+
+    auto elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cerr << "made " << calls << " calls on " << corpus.tokens.size() << " tokens, " << decoded << " decoded and "
+        << encoded << " encoded, in " << elapsed << "s" << endl;
+
+    return decoded == 0 ? 1 : 0;
+}
@@ -0,0 +1,260 @@
+#include <cstdint>
+#include <exception>
+#include <new>
+
+#include "jwt.hpp"
+#include "arena.hpp"
+#include "instrument.hpp"
+
+using namespace std;
+using namespace nlohmann;
+
+namespace jwt {
+    namespace detail {
+        // Every allocation is prefixed with where it came from. Keeping the prefix a full alignment
+        // unit keeps the memory after it aligned.
+        constexpr size_t arenaAlign = alignof(max_align_t);
+        constexpr uintptr_t fromHeap = 0;
+        constexpr uintptr_t fromArena = 1;
+
+        thread_local Arena* currentArena{ nullptr };
+
+        size_t alignUp(size_t size) {
+            return (size + arenaAlign - 1) & ~(arenaAlign - 1);
+        }
+    }
+
+    Arena::Arena(size_t blockSize)
+        : m_blockSize{ detail::alignUp(blockSize == 0 ? 1 : blockSize) }
+    {
+    }
+
+    Arena::~Arena() {
+        for (auto& block : m_blocks) {
+            ::operator delete(block.data);
+        }
+    }
+
+    void Arena::grow(size_t size) {
+        auto blockSize = size > m_blockSize ? size : m_blockSize;
+
+        m_blocks.push_back(Block{ static_cast<char*>(::operator new(blockSize)), blockSize });
+        m_offset = 0;
+    }
+
+    void* Arena::allocate(size_t size) {
+        size = detail::alignUp(size);
+
+        if (m_blocks.empty() || m_blocks.back().size - m_offset < size) {
+            grow(size);
+        }
+
+        auto p = m_blocks.back().data + m_offset;
+
+        m_offset += size;
+        m_used += size;
+
+        return p;
+    }
+
+    void Arena::reset() {
+        if (m_blocks.size() > 1) {
+            size_t total = 0;
+
+            for (auto& block : m_blocks) {
+                total += block.size;
+                ::operator delete(block.data);
+            }
+
+            m_blocks.clear();
+            m_blockSize = total;
+            grow(total);
+        }
+
+        m_offset = 0;
+        m_used = 0;
+    }
+
+    ArenaScope::ArenaScope(Arena& arena) : m_previous{ detail::currentArena } {
+        detail::currentArena = &arena;
+    }
+
+    ArenaScope::~ArenaScope() {
+        detail::currentArena = m_previous;
+    }
+
+    namespace detail {
+        void* arenaAllocate(size_t size) {
+            char* p{};
+            uintptr_t from{};
+
+            if (currentArena != nullptr) {
+                p = static_cast<char*>(currentArena->allocate(size + arenaAlign));
+                from = fromArena;
+            }
+            else {
+                p = static_cast<char*>(::operator new(size + arenaAlign));
+                from = fromHeap;
+            }
+
+            *reinterpret_cast<uintptr_t*>(p) = from;
+
+            return p + arenaAlign;
+        }
+
+        void arenaDeallocate(void* p) {
+            auto block = static_cast<char*>(p) - arenaAlign;
+
+            // Arena memory is only freed by the arena.
+            if (*reinterpret_cast<uintptr_t*>(block) == fromHeap) {
+                ::operator delete(block);
+            }
+        }
+    }
+
+    namespace {
+        // The limits the arena decodes that don't take any parse with, so their payloads are still
+        // built by LimitedSax on the arena.
+        const Limits& noLimits() {
+            static const Limits limits = []() {
+                Limits limits{};
+
+                limits.maxTokenSize = SIZE_MAX;
+                limits.maxHeaderSize = SIZE_MAX;
+                limits.maxPayloadSize = SIZE_MAX;
+                limits.maxDepth = SIZE_MAX;
+                limits.maxClaims = SIZE_MAX;
+                return limits;
+            }();
+
+            return limits;
+        }
+
+        // Parses the verified payload in [begin, end) into the current arena. Returns a null json
+        // object if it isn't base64url, and throws what ArenaJson::parse would if it isn't json.
+        ArenaJson parsePayload(const char* begin, const char* end) {
+            if (!detail::Base64UrlIterator::valid(begin, end)) {
+                JWT_OUTCOME(Malformed);
+                return ArenaJson{};
+            }
+
+            JWT_STAGE(Payload);
+
+            ArenaJson payload{};
+            detail::LimitedSax<ArenaJson> sax{ payload, noLimits() };
+
+            if (!ArenaJson::sax_parse(detail::Base64UrlIterator{ begin, end }, detail::Base64UrlIterator{ end, end }, &sax)) {
+                rethrow_exception(sax.error());
+            }
+
+            JWT_OUTCOME(Ok);
+
+            return payload;
+        }
+    }
+
+    ArenaString encode(const json& payload, const string& key, Arena& arena, const string& alg) {
+        JWT_CALL(Encode, nullptr);
+
+        ArenaScope scope{ arena };
+        ArenaString token{};
+
+        if (!detail::encodeToken(payload, key, alg, token)) {
+            return ArenaString{};
+        }
+
+        JWT_OUTCOME(Ok);
+
+        return token;
+    }
+
+    ArenaJson decode(const string& jwt, const string& key, Arena& arena, const set<string>& alg) {
+        JWT_CALL(Decode, &jwt);
+
+        ArenaScope scope{ arena };
+        string theAlg{};
+        size_t firstPeriod{};
+        size_t secondPeriod{};
+
+        if (detail::headerAlg(jwt, theAlg, firstPeriod, secondPeriod) != VerifyStatus::Ok
+            || detail::signatureStatus(jwt, key, theAlg, alg, secondPeriod) != VerifyStatus::Ok) {
+            return ArenaJson{};
+        }
+
+        return parsePayload(jwt.data() + firstPeriod + 1, jwt.data() + secondPeriod);
+    }
+
+    ArenaJson decode(const string& jwt, const string& key, const Limits& limits, VerifyStatus& status, Arena& arena, const set<string>& alg) {
+        JWT_CALL(Decode, &jwt);
+
+        if (!detail::withinLimits(jwt, limits, true)) {
+            status = VerifyStatus::LimitExceeded;
+            return ArenaJson{};
+        }
+
+        ArenaScope scope{ arena };
+        string theAlg{};
+        size_t firstPeriod{};
+        size_t secondPeriod{};
+
+        status = detail::headerAlg(jwt, theAlg, firstPeriod, secondPeriod);
+
+        if (status == VerifyStatus::Ok) {
+            status = detail::signatureStatus(jwt, key, theAlg, alg, secondPeriod);
+        }
+
+        if (status != VerifyStatus::Ok) {
+            return ArenaJson{};
+        }
+
+        auto payloadBegin = jwt.data() + firstPeriod + 1;
+        auto payloadEnd = jwt.data() + secondPeriod;
+
+        if (!detail::Base64UrlIterator::valid(payloadBegin, payloadEnd)) {
+            status = VerifyStatus::Malformed;
+            JWT_OUTCOME(Malformed);
+            return ArenaJson{};
+        }
+
+        JWT_STAGE(Payload);
+
+        ArenaJson payload{};
+        detail::LimitedSax<ArenaJson> sax{ payload, limits };
+
+        if (!ArenaJson::sax_parse(detail::Base64UrlIterator{ payloadBegin, payloadEnd }, detail::Base64UrlIterator{ payloadEnd, payloadEnd }, &sax)) {
+            if (sax.limitExceeded()) {
+                status = VerifyStatus::LimitExceeded;
+            }
+            else {
+                status = VerifyStatus::Malformed;
+                JWT_OUTCOME(Malformed);
+            }
+
+            return ArenaJson{};
+        }
+
+        JWT_OUTCOME(Ok);
+
+        return payload;
+    }
+
+    ArenaJson decode(const string& jwt, HeaderCache& cache, Arena& arena, const set<string>& alg) {
+        JWT_CALL(Decode, &jwt);
+
+        auto entry = cache.lookup(jwt);
+
+        if (entry == nullptr) {
+            return ArenaJson{};
+        }
+
+        ArenaScope scope{ arena };
+        auto firstPeriod = entry->encoded.length();
+        auto secondPeriod = jwt.find('.', firstPeriod + 1);
+
+        if (secondPeriod == string::npos || !detail::verifySignature(jwt, entry->key, algName(entry->alg), alg, secondPeriod)) {
+            return ArenaJson{};
+        }
+
+        return parsePayload(jwt.data() + firstPeriod + 1, jwt.data() + secondPeriod);
+    }
+}
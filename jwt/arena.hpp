@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "cache.hpp"
+#include "jwt.hpp"
+#include "json.hpp"
+
+namespace jwt {
+    // A bump allocator that hands out memory from a few large blocks and frees all of it at once.
+    // Not thread safe, use one per thread or per request.
+    class Arena {
+    public:
+        explicit Arena(size_t blockSize = 4096);
+        ~Arena();
+
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        void* allocate(size_t size);
+
+        // Frees everything allocated from the arena. Anything still pointing into it is left dangling.
+        // If the last round needed more than one block they're merged into one big enough for it.
+        void reset();
+
+        // Bytes handed out since the last reset.
+        size_t used() const {
+            return m_used;
+        }
+
+    private:
+        struct Block {
+            char* data;
+            size_t size;
+        };
+
+        void grow(size_t size);
+
+        std::vector<Block> m_blocks{};
+        size_t m_blockSize;
+        size_t m_offset{ 0 };
+        size_t m_used{ 0 };
+    };
+
+    // Routes ArenaAllocator allocations on this thread to the arena while it's alive. Scopes nest.
+    class ArenaScope {
+    public:
+        explicit ArenaScope(Arena& arena);
+        ~ArenaScope();
+
+        ArenaScope(const ArenaScope&) = delete;
+        ArenaScope& operator=(const ArenaScope&) = delete;
+
+    private:
+        Arena* m_previous;
+    };
+
+    namespace detail {
+        // Allocates from the thread's current arena, or the heap outside of an ArenaScope. Each block
+        // remembers where it came from so it can be deallocated anywhere.
+        void* arenaAllocate(size_t size);
+        void arenaDeallocate(void* p);
+    }
+
+    // A stateless allocator over the thread's current arena. nlohmann::basic_json default constructs
+    // its allocators so the arena can't be passed in directly.
+    template <typename T>
+    class ArenaAllocator {
+    public:
+        using value_type = T;
+
+        ArenaAllocator() = default;
+
+        template <typename U>
+        ArenaAllocator(const ArenaAllocator<U>&) {}
+
+        T* allocate(size_t n) {
+            return static_cast<T*>(detail::arenaAllocate(n * sizeof(T)));
+        }
+
+        void deallocate(T* p, size_t) {
+            detail::arenaDeallocate(p);
+        }
+
+        template <typename U>
+        bool operator==(const ArenaAllocator<U>&) const {
+            return true;
+        }
+
+        template <typename U>
+        bool operator!=(const ArenaAllocator<U>&) const {
+            return false;
+        }
+    };
+
+    using ArenaString = std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>>;
+    using ArenaJson = nlohmann::basic_json<std::map, std::vector, ArenaString, bool, std::int64_t, std::uint64_t, double, ArenaAllocator>;
+
+    // Every decode overload that returns a json document, and encode, have arena versions. Inside
+    // them the result and the library's own scratch come from the arena: the raw signature of an RS
+    // or ES token, the encoded token as it's built and signed, and the stack the payload is parsed
+    // with. What's left on the heap isn't the library's to place: OpenSSL's key parsing and digest
+    // contexts use its own allocator, nlohmann's parser keeps a token buffer and a stack of its own,
+    // and each json dump in encode allocates the serializer's output adapter and indent buffer.
+
+    // Like encode but the token lives in the arena, as does the signature while it's made. Returns
+    // an empty string on failure.
+    ArenaString encode(const nlohmann::json& payload, const std::string& key, Arena& arena, const std::string& alg = "");
+
+    // Like decode but the returned json lives in the arena. The header is only peeked at for its alg
+    // so the arena holds the whole result. Returns a null json object on failure, and throws like
+    // decode on a payload that isn't json.
+    ArenaJson decode(const std::string& jwt, const std::string& key, Arena& arena, const std::set<std::string>& alg = {});
+
+    // Like decode with limits but the returned json lives in the arena. Returns a null json object on
+    // failure.
+    ArenaJson decode(const std::string& jwt, const std::string& key, const Limits& limits, VerifyStatus& status, Arena& arena, const std::set<std::string>& alg = {});
+
+    // Like decode with a HeaderCache but the returned json lives in the arena. Returns a null json
+    // object on failure, and throws like decode on a payload that isn't json.
+    ArenaJson decode(const std::string& jwt, HeaderCache& cache, Arena& arena, const std::set<std::string>& alg = {});
+
+    namespace detail {
+        // Builds the token encode would return into token. Returns false on failure.
+        bool encodeToken(const nlohmann::json& payload, const std::string& key, const std::string& alg, ArenaString& token);
+    }
+}
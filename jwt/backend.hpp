@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+#include <set>
+#include <utility>
+
+#include "jwt.hpp"
+
+namespace jwt {
+    // A json backend parses the decoded header and payload of a jwt. Backends are objects so they
+    // can keep parser state between tokens and look like this:
+    //
+    //     struct Backend {
+    //         // The parsed payload handed back by decode.
+    //         using Document = ...;
+    //
+    //         // Extracts the alg member of the decoded header. Returns false on failure.
+    //         bool parseHeader(const std::string& header, std::string& alg);
+    //
+    //         // Parses the decoded payload. Returns false on failure.
+    //         bool parse(std::string payload, Document& document);
+    //     };
+    //
+    // Decoding with NlohmannBackend accepts the same tokens as jwt::decode(jwt, key), but returns false
+    // where decode throws json::exception: on a header or payload that isn't json, or a header
+    // without a string alg.
+    struct NlohmannBackend {
+        using Document = nlohmann::json;
+
+        bool parseHeader(const std::string& header, std::string& alg) {
+            auto parsed = nlohmann::json::parse(header, nullptr, false);
+
+            if (!parsed.is_object() || !parsed["alg"].is_string()) {
+                return false;
+            }
+
+            alg = parsed["alg"].get<std::string>();
+            return true;
+        }
+
+        bool parse(std::string payload, Document& document) {
+            document = nlohmann::json::parse(payload, nullptr, false);
+
+            return !document.is_discarded();
+        }
+    };
+
+    // Decodes the jwt using the given json backend. The document is only valid for as long as the
+    // backend says it is. Returns false on failure.
+    template <typename Backend>
+    bool decode(const std::string& jwt, const std::string& key, Backend& backend, typename Backend::Document& document, const std::set<std::string>& alg = {}) {
+        std::string header{};
+        std::string theAlg{};
+        std::string payload{};
+
+        if (!detail::decodeHeader(jwt, header) || !backend.parseHeader(header, theAlg)) {
+            return false;
+        }
+
+        if (!detail::verifyPayload(jwt, key, theAlg, alg, payload)) {
+            return false;
+        }
+
+        return backend.parse(std::move(payload), document);
+    }
+}
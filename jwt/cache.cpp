@@ -0,0 +1,131 @@
+#include <cstring>
+
+#include "cache.hpp"
+#include "instrument.hpp"
+
+using namespace std;
+using namespace nlohmann;
+
+namespace jwt {
+    HeaderCache::HeaderCache(KeyResolver resolver, size_t capacity)
+        : m_resolver(move(resolver)), m_capacity(capacity == 0 ? 1 : capacity)
+    {
+        m_entries.reserve(m_capacity);
+    }
+
+    const HeaderCache::Entry* HeaderCache::lookup(const string& jwt) {
+        auto firstPeriod = jwt.find('.');
+
+        if (firstPeriod == string::npos) {
+            return nullptr;
+        }
+
+        auto hash = detail::hashBytes(jwt.data(), firstPeriod);
+
+        for (auto& entry : m_entries) {
+            if (entry.hash == hash && entry.encoded.length() == firstPeriod && memcmp(entry.encoded.data(), jwt.data(), firstPeriod) == 0) {
+                ++m_hits;
+                JWT_CACHE(Hit);
+                return &entry;
+            }
+        }
+
+        ++m_misses;
+        JWT_CACHE(Miss);
+
+        // Parse the header the slow way and remember the result.
+        string decodedHeader{};
+        json header{};
+
+        {
+            JWT_STAGE(Header);
+
+            if (!detail::decodeHeader(jwt, decodedHeader)) {
+                return nullptr;
+            }
+
+            header = json::parse(decodedHeader, nullptr, false);
+        }
+
+        if (!header.is_object() || !header["alg"].is_string()) {
+            return nullptr;
+        }
+
+        Entry entry{};
+
+        entry.alg = algFromName(header["alg"].get_ref<const string&>());
+
+        if (entry.alg == Alg::Unknown) {
+            return nullptr;
+        }
+
+        if (header["kid"].is_string()) {
+            entry.kid = header["kid"].get<string>();
+        }
+
+        bool resolved{};
+
+        {
+            JWT_STAGE(Key);
+            resolved = m_resolver && m_resolver(entry.kid, entry.alg, entry.key);
+        }
+
+        if (!resolved) {
+            JWT_OUTCOME(BadKey);
+            return nullptr;
+        }
+
+        entry.encoded = jwt.substr(0, firstPeriod);
+        entry.hash = hash;
+
+        if (m_entries.size() < m_capacity) {
+            m_entries.push_back(move(entry));
+            return &m_entries.back();
+        }
+
+        // Evict round robin, there are only a few distinct headers in practice.
+        auto& slot = m_entries[m_next];
+
+        m_next = (m_next + 1) % m_capacity;
+        slot = move(entry);
+
+        return &slot;
+    }
+
+    void HeaderCache::clear() {
+        m_entries.clear();
+        m_next = 0;
+    }
+
+    json decode(const string& jwt, HeaderCache& cache, const set<string>& alg) {
+        JWT_CALL(Decode, &jwt);
+
+        auto entry = cache.lookup(jwt);
+
+        if (entry == nullptr) {
+            return json{};
+        }
+
+        auto firstPeriod = entry->encoded.length();
+        auto secondPeriod = jwt.find('.', firstPeriod + 1);
+
+        if (secondPeriod == string::npos || !detail::verifySignature(jwt, entry->key, algName(entry->alg), alg, secondPeriod)) {
+            return json{};
+        }
+
+        auto payloadBegin = jwt.data() + firstPeriod + 1;
+        auto payloadEnd = jwt.data() + secondPeriod;
+
+        if (!detail::Base64UrlIterator::valid(payloadBegin, payloadEnd)) {
+            return json{};
+        }
+
+        JWT_STAGE(Payload);
+
+        auto payload = json::parse(detail::Base64UrlIterator{ payloadBegin, payloadEnd }, detail::Base64UrlIterator{ payloadEnd, payloadEnd });
+
+        JWT_OUTCOME(Ok);
+
+        return payload;
+    }
+}
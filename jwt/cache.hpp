@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "jwt.hpp"
+
+namespace jwt {
+    // Remembers what a handful of encoded header segments parsed to, so tokens sharing one of them
+    // skip header decoding and key resolution entirely. A hit costs a hash of the encoded header and
+    // a memcmp. Not thread safe, use one per thread.
+    class HeaderCache {
+    public:
+        // Resolves the key to verify tokens with from the header's kid (empty if it has none) and alg.
+        // Only called on misses. Returns false if there's no key, in which case nothing is cached.
+        using KeyResolver = std::function<bool(const std::string& kid, Alg alg, std::string& key)>;
+
+        struct Entry {
+            std::string encoded{};
+            uint32_t hash{ 0 };
+            Alg alg{ Alg::Unknown };
+            std::string kid{};
+            std::string key{};
+        };
+
+        explicit HeaderCache(KeyResolver resolver, size_t capacity = 8);
+
+        // Returns the entry for the jwt's header, parsing it and resolving its key on a miss. The
+        // entry is only valid until the next lookup. Returns nullptr on failure.
+        const Entry* lookup(const std::string& jwt);
+
+        void clear();
+
+        size_t hits() const {
+            return m_hits;
+        }
+
+        size_t misses() const {
+            return m_misses;
+        }
+
+    private:
+        KeyResolver m_resolver;
+        std::vector<Entry> m_entries{};
+        size_t m_capacity;
+        size_t m_next{ 0 };
+        size_t m_hits{ 0 };
+        size_t m_misses{ 0 };
+    };
+
+    // Decodes the jwt using the cache for its header and key. Returns a null json object on failure.
+    nlohmann::json decode(const std::string& jwt, HeaderCache& cache, const std::set<std::string>& alg = {});
+}
@@ -0,0 +1,379 @@
+#include "capture.hpp"
+
+using namespace std;
+using namespace nlohmann;
+
+namespace jwt {
+    namespace {
+        const char captureMagic[4] = { 'J', 'W', 'T', 'R' };
+        constexpr uint32_t captureVersion = 1;
+
+        // Magic, version, slot size, capacity and the number of samples ever written, padded.
+        constexpr size_t captureHeaderSize = 32;
+
+        // How many samples the writer thread writes before it updates the header and flushes.
+        constexpr uint32_t captureFlushEvery = 64;
+
+        void put32(string& out, uint32_t value) {
+            for (int i = 0; i < 4; ++i) {
+                out += (char)((value >> (i * 8)) & 0xff);
+            }
+        }
+
+        void put64(string& out, uint64_t value) {
+            put32(out, (uint32_t)value);
+            put32(out, (uint32_t)(value >> 32));
+        }
+
+        void putString(string& out, const string& value) {
+            put32(out, (uint32_t)value.length());
+            out += value;
+        }
+
+        bool get32(const string& in, size_t& pos, uint32_t& value) {
+            if (in.length() < 4 || pos > in.length() - 4) {
+                return false;
+            }
+
+            value = 0;
+
+            for (int i = 0; i < 4; ++i) {
+                value |= (uint32_t)(uint8_t)in[pos++] << (i * 8);
+            }
+
+            return true;
+        }
+
+        bool getString(const string& in, size_t& pos, string& value) {
+            uint32_t length{};
+
+            if (!get32(in, pos, length) || length > in.length() - pos) {
+                return false;
+            }
+
+            value = in.substr(pos, length);
+            pos += length;
+            return true;
+        }
+
+        string captureHeader(uint32_t slotSize, uint32_t capacity, uint64_t written) {
+            string out{ captureMagic, sizeof(captureMagic) };
+
+            put32(out, captureVersion);
+            put32(out, slotSize);
+            put32(out, capacity);
+            put64(out, written);
+            out.resize(captureHeaderSize, '\0');
+
+            return out;
+        }
+    }
+
+    namespace detail {
+        void anonymize(json& value) {
+            switch (value.type()) {
+            case json::value_t::object:
+            case json::value_t::array:
+                for (auto& item : value) {
+                    anonymize(item);
+                }
+                break;
+            case json::value_t::string:
+                value = string(value.get_ref<const string&>().length(), 'x');
+                break;
+            case json::value_t::number_integer:
+            case json::value_t::number_unsigned: {
+                // As many 9s as it had digits, which keeps times like exp in the future.
+                auto digits = value.dump().length() - (value.is_number_integer() && value.get<int64_t>() < 0 ? 1 : 0);
+                uint64_t filler = 0;
+
+                for (size_t i = 0; i < digits && i < 19; ++i) {
+                    filler = filler * 10 + 9;
+                }
+
+                value = filler;
+                break;
+            }
+            case json::value_t::number_float:
+                value = 0.5;
+                break;
+            default:
+                break;
+            }
+        }
+
+        CapturedToken captureToken(const string& jwt, Alg alg, Outcome outcome) {
+            CapturedToken token{};
+
+            token.alg = alg;
+            token.outcome = outcome;
+            token.tokenSize = (uint32_t)jwt.length();
+            token.tokenHash = hashBytes(jwt.data(), jwt.length());
+
+            auto firstPeriod = jwt.find('.');
+
+            if (firstPeriod == string::npos || !b64urlDecode(jwt.data(), jwt.data() + firstPeriod, token.header)) {
+                token.header.clear();
+                return token;
+            }
+
+            auto secondPeriod = jwt.find('.', firstPeriod + 1);
+            string payload{};
+
+            if (secondPeriod == string::npos || !b64urlDecode(jwt.data() + firstPeriod + 1, jwt.data() + secondPeriod, payload)) {
+                return token;
+            }
+
+            token.payloadSize = (uint32_t)payload.length();
+
+            auto parsed = json::parse(payload, nullptr, false);
+
+            if (!parsed.is_discarded()) {
+                anonymize(parsed);
+                token.payload = parsed.dump();
+            }
+
+            return token;
+        }
+    }
+
+    TrafficCapture::TrafficCapture(InstrumentationSink* next, size_t queueCapacity)
+        : m_next{ next },
+        m_queueCapacity{ queueCapacity == 0 ? 1 : queueCapacity },
+        m_thread{ &TrafficCapture::run, this }
+    {
+    }
+
+    TrafficCapture::~TrafficCapture() {
+        {
+            lock_guard<mutex> lock{ m_mutex };
+            m_stop = true;
+        }
+
+        m_wake.notify_one();
+        m_thread.join();
+
+        if (m_file.is_open()) {
+            writeHeader();
+        }
+    }
+
+    bool TrafficCapture::open(const string& path, size_t capacity, size_t sampleEvery, size_t slotSize) {
+        unique_lock<mutex> lock{ m_mutex };
+
+        m_open = false;
+        m_idle.wait(lock, [this]() { return m_queue.empty() && !m_busy; });
+
+        if (m_file.is_open()) {
+            writeHeader();
+            m_file.close();
+        }
+
+        if (capacity == 0 || slotSize < 32) {
+            return false;
+        }
+
+        m_file.open(path, ios::in | ios::out | ios::binary | ios::trunc);
+
+        if (!m_file) {
+            return false;
+        }
+
+        m_capacity = (uint32_t)capacity;
+        m_slotSize = (uint32_t)slotSize;
+        m_sampleEvery = sampleEvery == 0 ? 1 : sampleEvery;
+        m_written = 0;
+        m_unflushed = 0;
+
+        auto header = captureHeader(m_slotSize, m_capacity, 0);
+
+        if (!m_file.write(header.data(), header.length())) {
+            return false;
+        }
+
+        // Size the file up front so wrapping around never has to grow it.
+        m_file.seekp(captureHeaderSize + (streamoff)m_capacity * m_slotSize - 1);
+
+        if (!m_file.put('\0') || !m_file.flush()) {
+            return false;
+        }
+
+        m_open = true;
+
+        return true;
+    }
+
+    void TrafficCapture::record(const CallRecord& call) {
+        if (m_next != nullptr) {
+            m_next->record(call);
+        }
+
+        if (call.operation != Operation::Decode || call.token == nullptr || !m_open.load(memory_order_relaxed)) {
+            return;
+        }
+
+        if (m_calls.fetch_add(1, memory_order_relaxed) % m_sampleEvery.load(memory_order_relaxed) != 0) {
+            return;
+        }
+
+        // Copied before taking the lock, so callers only hold it to queue the sample.
+        Sample sample{ *call.token, call.alg, call.outcome };
+
+        {
+            lock_guard<mutex> lock{ m_mutex };
+
+            if (!m_open) {
+                return;
+            }
+
+            if (m_queue.size() >= m_queueCapacity) {
+                m_dropped.fetch_add(1, memory_order_relaxed);
+                return;
+            }
+
+            m_queue.push_back(move(sample));
+        }
+
+        m_wake.notify_one();
+    }
+
+    void TrafficCapture::flush() {
+        unique_lock<mutex> lock{ m_mutex };
+
+        m_idle.wait(lock, [this]() { return m_queue.empty() && !m_busy; });
+
+        if (m_file.is_open()) {
+            writeHeader();
+        }
+    }
+
+    void TrafficCapture::run() {
+        unique_lock<mutex> lock{ m_mutex };
+
+        for (;;) {
+            m_wake.wait(lock, [this]() { return m_stop || !m_queue.empty(); });
+
+            if (m_queue.empty()) {
+                return;
+            }
+
+            auto sample = move(m_queue.front());
+
+            m_queue.pop_front();
+            m_busy = true;
+            lock.unlock();
+
+            write(sample);
+
+            lock.lock();
+            m_busy = false;
+
+            if (m_queue.empty()) {
+                m_idle.notify_all();
+            }
+        }
+    }
+
+    void TrafficCapture::write(const Sample& sample) {
+        auto token = detail::captureToken(sample.jwt, sample.alg, sample.outcome);
+        string slot{};
+
+        put32(slot, 0);
+        slot += (char)token.alg;
+        slot += (char)token.outcome;
+        put32(slot, token.tokenSize);
+        put32(slot, token.tokenHash);
+        put32(slot, token.payloadSize);
+        putString(slot, token.header);
+        putString(slot, token.payload);
+
+        if (slot.length() > m_slotSize) {
+            m_dropped.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+
+        auto length = slot.length() - 4;
+
+        for (int i = 0; i < 4; ++i) {
+            slot[i] = (char)((length >> (i * 8)) & 0xff);
+        }
+
+        m_file.seekp(captureHeaderSize + (streamoff)(m_written % m_capacity) * m_slotSize);
+        m_file.write(slot.data(), slot.length());
+        ++m_written;
+
+        m_captured.fetch_add(1, memory_order_relaxed);
+
+        if (++m_unflushed >= captureFlushEvery) {
+            writeHeader();
+        }
+    }
+
+    void TrafficCapture::writeHeader() {
+        auto header = captureHeader(m_slotSize, m_capacity, m_written);
+
+        m_file.seekp(0);
+        m_file.write(header.data(), header.length());
+        m_file.flush();
+        m_unflushed = 0;
+    }
+
+    bool readCapture(const string& path, vector<CapturedToken>& tokens) {
+        ifstream file{ path, ios::binary };
+
+        if (!file) {
+            return false;
+        }
+
+        string data{ istreambuf_iterator<char>{ file }, istreambuf_iterator<char>{} };
+
+        if (data.length() < captureHeaderSize || data.compare(0, sizeof(captureMagic), captureMagic, sizeof(captureMagic)) != 0) {
+            return false;
+        }
+
+        size_t pos = sizeof(captureMagic);
+        uint32_t version{};
+        uint32_t slotSize{};
+        uint32_t capacity{};
+        uint32_t writtenLow{};
+        uint32_t writtenHigh{};
+
+        if (!get32(data, pos, version) || version != captureVersion || !get32(data, pos, slotSize) || !get32(data, pos, capacity)
+            || !get32(data, pos, writtenLow) || !get32(data, pos, writtenHigh)
+            || capacity == 0 || data.length() < captureHeaderSize + (uint64_t)capacity * slotSize)
+        {
+            return false;
+        }
+
+        auto written = (uint64_t)writtenHigh << 32 | writtenLow;
+        auto count = written < capacity ? written : capacity;
+
+        tokens.clear();
+
+        for (uint64_t i = written - count; i < written; ++i) {
+            pos = captureHeaderSize + (size_t)(i % capacity) * slotSize;
+
+            uint32_t length{};
+
+            if (!get32(data, pos, length) || length < 22 || length > slotSize - 4) {
+                return false;
+            }
+
+            CapturedToken token{};
+
+            token.alg = (Alg)(uint8_t)data[pos++];
+            token.outcome = (Outcome)(uint8_t)data[pos++];
+
+            if (!get32(data, pos, token.tokenSize) || !get32(data, pos, token.tokenHash) || !get32(data, pos, token.payloadSize)
+                || !getString(data, pos, token.header) || !getString(data, pos, token.payload)
+                || token.alg > Alg::ES512 || token.outcome >= Outcome::Count)
+            {
+                return false;
+            }
+
+            tokens.push_back(move(token));
+        }
+
+        return true;
+    }
+}
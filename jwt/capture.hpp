@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "jwt.hpp"
+#include "instrument.hpp"
+#include "json.hpp"
+
+namespace jwt {
+    // The shape of one decoded token, with nothing in it that could be replayed against production.
+    struct CapturedToken {
+        Alg alg{ Alg::Unknown };
+        Outcome outcome{ Outcome::Malformed };
+        uint32_t tokenSize{ 0 };
+
+        // FNV-1a of the whole token, so repeats of a token can be told apart from fresh ones.
+        uint32_t tokenHash{ 0 };
+
+        // The decoded header as it was, with its alg, kid and typ. Empty if it wasn't base64url.
+        std::string header{};
+
+        // The decoded payload's size, and the payload with the same claims but every string and integer
+        // replaced by a filler of the same length, and every other number by 0.5. Empty if the payload
+        // wasn't json.
+        uint32_t payloadSize{ 0 };
+        std::string payload{};
+    };
+
+    // An InstrumentationSink that samples decode calls into a ring of fixed size slots in a file, so
+    // the newest capacity samples are kept. Install it with setInstrumentationSink, and give it the
+    // sink that was installed before so that sink still sees every call. Sampled tokens are copied
+    // onto a queue and taken apart and written on a thread of its own, so callers never wait for the
+    // file. Samples that arrive while queueCapacity are already waiting, or that are too big for a
+    // slot, are dropped. Nothing is recorded unless the library is built with -Dinstrumentation=ON,
+    // which is off by default.
+    class TrafficCapture : public InstrumentationSink {
+    public:
+        explicit TrafficCapture(InstrumentationSink* next = nullptr, size_t queueCapacity = 1024);
+        ~TrafficCapture();
+
+        TrafficCapture(const TrafficCapture&) = delete;
+        TrafficCapture& operator=(const TrafficCapture&) = delete;
+
+        // Creates the file, replacing any that's there, and starts capturing one decode in every
+        // sampleEvery. Samples still queued for a file opened before are written to it first. Returns
+        // false on failure.
+        bool open(const std::string& path, size_t capacity = 4096, size_t sampleEvery = 100, size_t slotSize = 4096);
+
+        void record(const CallRecord& call) override;
+
+        // Waits until every queued sample has been written, then updates the file's header and
+        // flushes it so readCapture sees them. Also done every 64 samples and on destruction.
+        void flush();
+
+        uint64_t captured() const {
+            return m_captured.load(std::memory_order_relaxed);
+        }
+
+        uint64_t dropped() const {
+            return m_dropped.load(std::memory_order_relaxed);
+        }
+
+    private:
+        struct Sample {
+            std::string jwt;
+            Alg alg;
+            Outcome outcome;
+        };
+
+        void run();
+        void write(const Sample& sample);
+        void writeHeader();
+
+        InstrumentationSink* m_next;
+        size_t m_queueCapacity;
+
+        std::mutex m_mutex{};
+        std::condition_variable m_wake{};
+        std::condition_variable m_idle{};
+        std::deque<Sample> m_queue{};
+        bool m_busy{ false };
+        bool m_stop{ false };
+
+        // Used by the writer thread while it's busy, and by open and flush only under the lock once
+        // it's idle.
+        std::fstream m_file{};
+        uint32_t m_capacity{ 0 };
+        uint32_t m_slotSize{ 0 };
+        uint64_t m_written{ 0 };
+        uint32_t m_unflushed{ 0 };
+
+        std::atomic<size_t> m_sampleEvery{ 1 };
+        std::atomic<bool> m_open{ false };
+        std::atomic<uint64_t> m_calls{ 0 };
+        std::atomic<uint64_t> m_captured{ 0 };
+        std::atomic<uint64_t> m_dropped{ 0 };
+
+        std::thread m_thread;
+    };
+
+    // Reads a capture file oldest sample first. Returns false on failure.
+    bool readCapture(const std::string& path, std::vector<CapturedToken>& tokens);
+
+    namespace detail {
+        // Takes the token apart into a CapturedToken.
+        CapturedToken captureToken(const std::string& jwt, Alg alg, Outcome outcome);
+
+        // Replaces the value's strings and numbers with fillers, keeping its keys.
+        void anonymize(nlohmann::json& value);
+    }
+}
@@ -0,0 +1,343 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <set>
+#include <type_traits>
+#include <vector>
+
+#include "jwt.hpp"
+
+namespace jwt {
+    enum class Claim {
+        Required,
+        Optional
+    };
+
+    // Specialize this for your own claims struct to decode tokens straight into it:
+    //
+    //     template <> struct jwt::ClaimSchema<MyClaims> {
+    //         template <typename Field>
+    //         static void fields(MyClaims& claims, Field& field) {
+    //             field("sub", claims.sub, jwt::Claim::Required);
+    //             field("exp", claims.exp, jwt::Claim::Required);
+    //             field("tenant_id", claims.tenant, jwt::Claim::Optional);
+    //         }
+    //     };
+    //
+    // Supported member types are std::string, bool, std::int64_t, std::uint64_t, double and
+    // std::vector<std::string>. Only the first 64 fields can be required.
+    template <typename T>
+    struct ClaimSchema {};
+
+    namespace detail {
+        enum class ClaimType {
+            None,
+            String,
+            Bool,
+            Int,
+            Uint,
+            Double,
+            StringArray
+        };
+
+        struct ClaimTarget {
+            ClaimTarget() = default;
+            ClaimTarget(std::string& v) : ptr{ &v }, type{ ClaimType::String } {}
+            ClaimTarget(bool& v) : ptr{ &v }, type{ ClaimType::Bool } {}
+            ClaimTarget(std::int64_t& v) : ptr{ &v }, type{ ClaimType::Int } {}
+            ClaimTarget(std::uint64_t& v) : ptr{ &v }, type{ ClaimType::Uint } {}
+            ClaimTarget(double& v) : ptr{ &v }, type{ ClaimType::Double } {}
+            ClaimTarget(std::vector<std::string>& v) : ptr{ &v }, type{ ClaimType::StringArray } {}
+
+            template <typename T>
+            T& as() const {
+                return *static_cast<T*>(ptr);
+            }
+
+            void* ptr{ nullptr };
+            ClaimType type{ ClaimType::None };
+        };
+
+        // Looks up the schema field for a top level key.
+        struct ClaimMatcher {
+            explicit ClaimMatcher(const std::string& key) : key(key) {}
+
+            template <typename T>
+            void operator()(const char* name, T& member, Claim) {
+                if (target.type == ClaimType::None && key == name) {
+                    target = ClaimTarget{ member };
+                    match = index;
+                }
+
+                ++index;
+            }
+
+            const std::string& key;
+            ClaimTarget target{};
+            std::size_t index{ 0 };
+            std::size_t match{ 0 };
+        };
+
+        // Makes sure every required field was seen.
+        struct ClaimChecker {
+            explicit ClaimChecker(std::uint64_t seen) : seen(seen) {}
+
+            template <typename T>
+            void operator()(const char*, T&, Claim presence) {
+                if (presence == Claim::Required && (index >= 64 || (seen & (1ull << index)) == 0)) {
+                    complete = false;
+                }
+
+                ++index;
+            }
+
+            std::uint64_t seen{ 0 };
+            std::size_t index{ 0 };
+            bool complete{ true };
+        };
+
+        template <typename T>
+        struct HasClaimSchema {
+            template <typename U>
+            static char test(decltype(&ClaimSchema<U>::template fields<ClaimMatcher>));
+
+            template <typename U>
+            static long test(...);
+
+            static const bool value = sizeof(test<T>(nullptr)) == 1;
+        };
+
+        // SAX handler that writes the top level members of the payload straight into the claims
+        // struct. Anything not in the schema is skipped without being stored.
+        template <typename Claims>
+        class ClaimSax {
+        public:
+            using json = nlohmann::json;
+
+            explicit ClaimSax(Claims& claims) : m_claims(claims) {}
+
+            bool null() {
+                // A null claim is treated the same as a missing one.
+                return value(true, [](const ClaimTarget&) -> bool { return true; });
+            }
+
+            bool boolean(bool val) {
+                return value(false, [&](const ClaimTarget& t) -> bool {
+                    if (t.type != ClaimType::Bool) {
+                        return false;
+                    }
+
+                    t.as<bool>() = val;
+                    return true;
+                });
+            }
+
+            bool number_integer(json::number_integer_t val) {
+                return value(false, [&](const ClaimTarget& t) -> bool {
+                    switch (t.type) {
+                    case ClaimType::Int:
+                        t.as<std::int64_t>() = val;
+                        return true;
+
+                    case ClaimType::Uint:
+                        t.as<std::uint64_t>() = static_cast<std::uint64_t>(val);
+                        return val >= 0;
+
+                    case ClaimType::Double:
+                        t.as<double>() = static_cast<double>(val);
+                        return true;
+
+                    default:
+                        return false;
+                    }
+                });
+            }
+
+            bool number_unsigned(json::number_unsigned_t val) {
+                return value(false, [&](const ClaimTarget& t) -> bool {
+                    switch (t.type) {
+                    case ClaimType::Int:
+                        t.as<std::int64_t>() = static_cast<std::int64_t>(val);
+                        return val <= static_cast<json::number_unsigned_t>(std::numeric_limits<std::int64_t>::max());
+
+                    case ClaimType::Uint:
+                        t.as<std::uint64_t>() = val;
+                        return true;
+
+                    case ClaimType::Double:
+                        t.as<double>() = static_cast<double>(val);
+                        return true;
+
+                    default:
+                        return false;
+                    }
+                });
+            }
+
+            bool number_float(json::number_float_t val, const json::string_t&) {
+                return value(false, [&](const ClaimTarget& t) -> bool {
+                    if (t.type != ClaimType::Double) {
+                        return false;
+                    }
+
+                    t.as<double>() = val;
+                    return true;
+                });
+            }
+
+            bool string(json::string_t& val) {
+                if (m_collecting) {
+                    m_target.as<std::vector<std::string>>().push_back(std::move(val));
+                    return true;
+                }
+
+                return value(false, [&](const ClaimTarget& t) -> bool {
+                    if (t.type != ClaimType::String) {
+                        return false;
+                    }
+
+                    t.as<std::string>() = std::move(val);
+                    return true;
+                });
+            }
+
+            bool binary(json::binary_t&) {
+                return false;
+            }
+
+            bool start_object(std::size_t) {
+                // The payload itself must be an object and schema fields can't be objects.
+                if (m_collecting || (m_depth == 0 && m_root) || (m_depth == 1 && m_target.type != ClaimType::None)) {
+                    return false;
+                }
+
+                m_root = true;
+                ++m_depth;
+                return true;
+            }
+
+            bool key(json::string_t& val) {
+                if (m_depth == 1) {
+                    ClaimMatcher matcher{ val };
+
+                    ClaimSchema<Claims>::fields(m_claims, matcher);
+                    m_target = matcher.target;
+                    m_index = matcher.match;
+                }
+
+                return true;
+            }
+
+            bool end_object() {
+                --m_depth;
+                return true;
+            }
+
+            bool start_array(std::size_t) {
+                if (m_depth == 0 || m_collecting) {
+                    return false;
+                }
+
+                if (m_depth == 1 && m_target.type != ClaimType::None) {
+                    if (m_target.type != ClaimType::StringArray) {
+                        return false;
+                    }
+
+                    m_target.as<std::vector<std::string>>().clear();
+                    m_collecting = true;
+                }
+
+                ++m_depth;
+                return true;
+            }
+
+            bool end_array() {
+                --m_depth;
+
+                if (m_collecting) {
+                    m_collecting = false;
+                    see();
+                }
+
+                return true;
+            }
+
+            bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception&) {
+                return false;
+            }
+
+            bool complete() const {
+                ClaimChecker checker{ m_seen };
+
+                ClaimSchema<Claims>::fields(m_claims, checker);
+                return checker.complete;
+            }
+
+        private:
+            template <typename Assign>
+            bool value(bool isNull, Assign assign) {
+                // Only string arrays are collected, anything else inside one is a type mismatch.
+                if (m_collecting) {
+                    return false;
+                }
+
+                if (m_depth == 0) {
+                    return false;
+                }
+
+                if (m_depth > 1 || m_target.type == ClaimType::None) {
+                    return true;
+                }
+
+                if (isNull) {
+                    m_target = ClaimTarget{};
+                    return true;
+                }
+
+                if (!assign(m_target)) {
+                    return false;
+                }
+
+                see();
+                return true;
+            }
+
+            void see() {
+                if (m_index < 64) {
+                    m_seen |= 1ull << m_index;
+                }
+
+                m_target = ClaimTarget{};
+            }
+
+            Claims& m_claims;
+            ClaimTarget m_target{};
+            std::size_t m_index{ 0 };
+            std::size_t m_depth{ 0 };
+            std::uint64_t m_seen{ 0 };
+            bool m_root{ false };
+            bool m_collecting{ false };
+        };
+    }
+
+    // Decodes the payload straight into a claims struct described by ClaimSchema<Claims> without
+    // building a json object. Returns false on failure, in which case claims may be partially written.
+    template <typename Claims>
+    typename std::enable_if<detail::HasClaimSchema<Claims>::value, bool>::type
+    decode(const std::string& jwt, const std::string& key, Claims& claims, const std::set<std::string>& alg = {}) {
+        const char* payloadBegin{};
+        const char* payloadEnd{};
+
+        if (!detail::verifyToken(jwt, key, alg, payloadBegin, payloadEnd)) {
+            return false;
+        }
+
+        detail::ClaimSax<Claims> sax{ claims };
+        detail::Base64UrlIterator begin{ payloadBegin, payloadEnd };
+        detail::Base64UrlIterator end{ payloadEnd, payloadEnd };
+
+        return nlohmann::json::sax_parse(begin, end, &sax) && sax.complete();
+    }
+}
@@ -0,0 +1,164 @@
+#include <chrono>
+#include <cstddef>
+#include <thread>
+
+#include "instrument.hpp"
+
+#ifdef JWT_USDT
+// Each probe gets a semaphore the tracer bumps while it's attached, so arguments are only gathered
+// when someone is listening. List them with `bpftrace -l 'usdt:/path/to/binary:jwt:*'`.
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+// Names the semaphore at index in jwt::detail::probeSemaphores jwt_<name>_semaphore, the symbol the
+// probe's note refers to.
+#define JWT_PROBE_SEMAPHORE(name, field, index) \
+    static_assert(offsetof(jwt::detail::ProbeSemaphores, field) == (index) * sizeof(unsigned short), "jwt_" #name "_semaphore is out of place"); \
+    __asm__(".globl jwt_" #name "_semaphore\n\t.set jwt_" #name "_semaphore, jwt_probe_semaphores + " #index " * 2")
+
+// encode/decode/verify__start(token length), and __done(alg, token length, outcome). alg, stage and
+// outcome are the values of the jwt::Alg, jwt::Stage and jwt::Outcome enums. encode's token length is 0.
+JWT_PROBE_SEMAPHORE(encode__start, encodeStart, 0);
+JWT_PROBE_SEMAPHORE(encode__done, encodeDone, 1);
+JWT_PROBE_SEMAPHORE(decode__start, decodeStart, 2);
+JWT_PROBE_SEMAPHORE(decode__done, decodeDone, 3);
+JWT_PROBE_SEMAPHORE(verify__start, verifyStart, 4);
+JWT_PROBE_SEMAPHORE(verify__done, verifyDone, 5);
+// stage__start(stage, alg, token length) and stage__done(stage, alg, token length, outcome so far).
+// The key stage is parsing a PEM key and the signature stage is signing or checking a signature.
+JWT_PROBE_SEMAPHORE(stage__start, stageStart, 6);
+JWT_PROBE_SEMAPHORE(stage__done, stageDone, 7);
+// signature__done(alg, token length, 1 if the signature was good) once a token has been checked.
+JWT_PROBE_SEMAPHORE(signature__done, signatureDone, 8);
+// cache__lookup(token length, 1 on a hit) for every HeaderCache lookup, before the alg is known.
+JWT_PROBE_SEMAPHORE(cache__lookup, cacheLookup, 9);
+#endif
+
+using namespace std;
+
+namespace jwt {
+    namespace detail {
+        atomic<InstrumentationSink*> instrumentationSink{ nullptr };
+
+        InstrumentationSlot& instrumentationSlot() {
+            static thread_local InstrumentationSlot slot{};
+            return slot;
+        }
+
+        void ScopedCall::begin(Operation operation, const string* token) {
+            auto& slot = instrumentationSlot();
+
+            if (slot.depth++ != 0) {
+                return;
+            }
+
+            slot.call = CallRecord{};
+            slot.call.operation = operation;
+            slot.call.outcome = Outcome::Malformed;
+            slot.call.token = token;
+            slot.call.tokenSize = token != nullptr ? token->length() : 0;
+            slot.start = ticks();
+
+#ifdef JWT_USDT
+            switch (operation) {
+            case Operation::Encode:
+                DTRACE_PROBE1(jwt, encode__start, slot.call.tokenSize);
+                break;
+            case Operation::Decode:
+                DTRACE_PROBE1(jwt, decode__start, slot.call.tokenSize);
+                break;
+            case Operation::Verify:
+                DTRACE_PROBE1(jwt, verify__start, slot.call.tokenSize);
+                break;
+            }
+#endif
+        }
+
+        void ScopedCall::end() {
+            auto& slot = instrumentationSlot();
+
+            if (--slot.depth != 0) {
+                return;
+            }
+
+            slot.call.totalTicks = ticks() - slot.start;
+
+#ifdef JWT_USDT
+            auto& call = slot.call;
+
+            switch (call.operation) {
+            case Operation::Encode:
+                DTRACE_PROBE3(jwt, encode__done, (int)call.alg, call.tokenSize, (int)call.outcome);
+                break;
+            case Operation::Decode:
+                DTRACE_PROBE3(jwt, decode__done, (int)call.alg, call.tokenSize, (int)call.outcome);
+                break;
+            case Operation::Verify:
+                DTRACE_PROBE3(jwt, verify__done, (int)call.alg, call.tokenSize, (int)call.outcome);
+                break;
+            }
+#endif
+
+            if (auto sink = instrumentationSink.load(memory_order_acquire)) {
+                sink->record(slot.call);
+            }
+        }
+
+#ifdef JWT_USDT
+        ProbeSemaphores probeSemaphores __attribute__((section(".probes"))){};
+
+        void stageProbe(Stage stage, bool done) {
+            auto& call = instrumentationSlot().call;
+
+            if (done) {
+                DTRACE_PROBE4(jwt, stage__done, (int)stage, (int)call.alg, call.tokenSize, (int)call.outcome);
+            }
+            else {
+                DTRACE_PROBE3(jwt, stage__start, (int)stage, (int)call.alg, call.tokenSize);
+            }
+        }
+
+        void cacheProbe(CacheLookup lookup) {
+            auto& call = instrumentationSlot().call;
+
+            DTRACE_PROBE2(jwt, cache__lookup, call.tokenSize, lookup == CacheLookup::Hit ? 1 : 0);
+        }
+
+        void signatureProbe(bool verified) {
+            auto& call = instrumentationSlot().call;
+
+            DTRACE_PROBE3(jwt, signature__done, (int)call.alg, call.tokenSize, verified ? 1 : 0);
+        }
+#endif
+
+        void setAlg(const string& alg) {
+            if (instrumenting()) {
+                instrumentationSlot().call.alg = algFromName(alg);
+            }
+        }
+    }
+
+    void setInstrumentationSink(InstrumentationSink* sink) {
+#ifdef JWT_INSTRUMENTATION
+        detail::instrumentationSink.store(sink, memory_order_release);
+#else
+        (void)sink;
+#endif
+    }
+
+    double ticksPerNanosecond() {
+        static const double rate = []() {
+            auto startTicks = detail::ticks();
+            auto start = chrono::steady_clock::now();
+
+            this_thread::sleep_for(chrono::milliseconds(10));
+
+            auto elapsedTicks = detail::ticks() - startTicks;
+            auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+
+            return elapsed > 0 ? (double)elapsedTicks / elapsed : 1.0;
+        }();
+
+        return rate;
+    }
+}
@@ -0,0 +1,265 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "jwt.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <chrono>
+#endif
+
+namespace jwt {
+    enum class Operation {
+        Encode,
+        Decode,
+        Verify
+    };
+
+    enum class Stage {
+        // Getting the alg out of the header.
+        Header,
+        // Parsing a PEM key.
+        Key,
+        // Computing or checking the signature.
+        Signature,
+        // Decoding and parsing the payload.
+        Payload,
+        // Serializing the header and payload in encode.
+        Serialize,
+        Count
+    };
+
+    enum class Outcome {
+        Ok,
+        Malformed,
+        AlgRejected,
+        BadKey,
+        BadSignature,
+        LimitExceeded,
+        Count
+    };
+
+    enum class CacheLookup {
+        None,
+        Hit,
+        Miss
+    };
+
+    // What one encode, decode or verify call spent its time on, in ticks. Stages that weren't
+    // reached are 0.
+    struct alignas(64) CallRecord {
+        Operation operation{ Operation::Decode };
+        Alg alg{ Alg::Unknown };
+        Outcome outcome{ Outcome::Ok };
+        CacheLookup cacheLookup{ CacheLookup::None };
+
+        // The token being decoded or verified, only valid during InstrumentationSink::record. nullptr
+        // and 0 for encode.
+        const std::string* token{ nullptr };
+        size_t tokenSize{ 0 };
+        uint64_t ticks[(size_t)Stage::Count]{};
+        uint64_t totalTicks{ 0 };
+    };
+
+    class InstrumentationSink {
+    public:
+        virtual ~InstrumentationSink() = default;
+
+        // Called on the calling thread at the end of every instrumented call, so it should be quick.
+        virtual void record(const CallRecord& call) = 0;
+    };
+
+    // Starts sending a CallRecord for every call to the sink, or stops if it's nullptr. Nothing is
+    // timed while there's no sink. The sink has to outlive any calls in flight when it's replaced.
+    // Does nothing if the library was built without JWT_INSTRUMENTATION.
+    void setInstrumentationSink(InstrumentationSink* sink);
+
+    // How many ticks make a nanosecond, measured once on first use.
+    double ticksPerNanosecond();
+
+    namespace detail {
+        extern std::atomic<InstrumentationSink*> instrumentationSink;
+
+        // The time stamp counter where there is one and the steady clock in nanoseconds elsewhere.
+        inline uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__) || defined(_MSC_VER)
+            return __rdtsc();
+#else
+            return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+        }
+
+#ifdef JWT_USDT
+        // The semaphores a tracer bumps while it has one of the library's USDT probes attached, one
+        // per probe. They're packed together so every one of them can be checked in three loads, and
+        // instrument.cpp gives each the jwt_<probe>_semaphore name its probe refers to.
+        struct alignas(8) ProbeSemaphores {
+            unsigned short encodeStart;
+            unsigned short encodeDone;
+            unsigned short decodeStart;
+            unsigned short decodeDone;
+            unsigned short verifyStart;
+            unsigned short verifyDone;
+            unsigned short stageStart;
+            unsigned short stageDone;
+            unsigned short signatureDone;
+            unsigned short cacheLookup;
+            unsigned short unused[2];
+        };
+
+        extern ProbeSemaphores probeSemaphores __asm__("jwt_probe_semaphores");
+
+        // Whether a tracer has any of the library's probes attached.
+        inline bool probesAttached() {
+            uint64_t words[sizeof(ProbeSemaphores) / sizeof(uint64_t)];
+
+            std::memcpy(words, &probeSemaphores, sizeof(words));
+
+            return (words[0] | words[1] | words[2]) != 0;
+        }
+
+        void stageProbe(Stage stage, bool done);
+        void cacheProbe(CacheLookup lookup);
+        void signatureProbe(bool verified);
+#endif
+
+        inline bool instrumenting() {
+#ifdef JWT_USDT
+            return instrumentationSink.load(std::memory_order_relaxed) != nullptr || probesAttached();
+#else
+            return instrumentationSink.load(std::memory_order_relaxed) != nullptr;
+#endif
+        }
+
+        // The record of the outermost instrumented call on this thread, and how deeply calls are nested.
+        struct alignas(64) InstrumentationSlot {
+            CallRecord call{};
+            size_t depth{ 0 };
+            uint64_t start{ 0 };
+        };
+
+        InstrumentationSlot& instrumentationSlot();
+
+        // Times an encode, decode or verify call. Only the outermost one on a thread is recorded,
+        // and only if there was a sink when it started.
+        class ScopedCall {
+        public:
+            ScopedCall(Operation operation, const std::string* token) : m_active{ instrumenting() } {
+                if (m_active) {
+                    begin(operation, token);
+                }
+            }
+
+            ~ScopedCall() {
+                if (m_active) {
+                    end();
+                }
+            }
+
+            ScopedCall(const ScopedCall&) = delete;
+            ScopedCall& operator=(const ScopedCall&) = delete;
+
+        private:
+            void begin(Operation operation, const std::string* token);
+            void end();
+
+            bool m_active;
+        };
+
+        // Adds the time until it goes out of scope to a stage of the current call.
+        class ScopedStage {
+        public:
+            explicit ScopedStage(Stage stage) : m_stage{ stage }, m_start{ instrumenting() ? ticks() : 0 } {
+#ifdef JWT_USDT
+                if (m_start != 0 && probeSemaphores.stageStart != 0) {
+                    stageProbe(m_stage, false);
+                }
+#endif
+            }
+
+            ~ScopedStage() {
+                if (m_start != 0) {
+                    auto& slot = instrumentationSlot();
+
+                    if (slot.depth != 0) {
+                        slot.call.ticks[(size_t)m_stage] += ticks() - m_start;
+                    }
+
+#ifdef JWT_USDT
+                    if (probeSemaphores.stageDone != 0) {
+                        stageProbe(m_stage, true);
+                    }
+#endif
+                }
+            }
+
+            ScopedStage(const ScopedStage&) = delete;
+            ScopedStage& operator=(const ScopedStage&) = delete;
+
+        private:
+            Stage m_stage;
+            uint64_t m_start;
+        };
+
+        inline void setOutcome(Outcome outcome) {
+            if (instrumenting()) {
+                instrumentationSlot().call.outcome = outcome;
+            }
+        }
+
+        inline void setAlg(Alg alg) {
+            if (instrumenting()) {
+                instrumentationSlot().call.alg = alg;
+            }
+        }
+
+        void setAlg(const std::string& alg);
+
+        inline void setCacheLookup(CacheLookup lookup) {
+            if (instrumenting()) {
+                instrumentationSlot().call.cacheLookup = lookup;
+#ifdef JWT_USDT
+                if (probeSemaphores.cacheLookup != 0) {
+                    cacheProbe(lookup);
+                }
+#endif
+            }
+        }
+
+        // Marks the end of checking a token's signature, whichever way it went.
+        inline void signatureChecked(bool verified) {
+#ifdef JWT_USDT
+            if (probeSemaphores.signatureDone != 0) {
+                signatureProbe(verified);
+            }
+#else
+            (void)verified;
+#endif
+        }
+    }
+}
+
+// Used inside the library so building without JWT_INSTRUMENTATION removes every trace of it.
+#ifdef JWT_INSTRUMENTATION
+#define JWT_CALL(operation, token) ::jwt::detail::ScopedCall jwtCall_{ ::jwt::Operation::operation, (token) }
+#define JWT_STAGE(stage) ::jwt::detail::ScopedStage jwtStage_{ ::jwt::Stage::stage }
+#define JWT_OUTCOME(outcome) ::jwt::detail::setOutcome(::jwt::Outcome::outcome)
+#define JWT_ALG(alg) ::jwt::detail::setAlg(alg)
+#define JWT_CACHE(lookup) ::jwt::detail::setCacheLookup(::jwt::CacheLookup::lookup)
+#define JWT_SIGNATURE(verified) ::jwt::detail::signatureChecked(verified)
+#else
+#define JWT_CALL(operation, token) do {} while (0)
+#define JWT_STAGE(stage) do {} while (0)
+#define JWT_OUTCOME(outcome) do {} while (0)
+#define JWT_ALG(alg) do {} while (0)
+#define JWT_CACHE(lookup) do {} while (0)
+#define JWT_SIGNATURE(verified) do {} while (0)
+#endif
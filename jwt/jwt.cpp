@@ -1,26 +1,64 @@
+#include <algorithm>
+#include <atomic>
 #include <vector>
 #include <cstdint>
-#include <functional>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <ostream>
+#include <streambuf>
 
 #include <openssl/bio.h>
 #include <openssl/evp.h>
 #include <openssl/hmac.h>
 #include <openssl/buffer.h>
+#include <openssl/err.h>
 #include <openssl/pem.h>
 
 #include "jwt.hpp"
+#include "arena.hpp"
+#include "instrument.hpp"
+#include "peek.hpp"
 
 using namespace std;
 using namespace nlohmann;
 
 namespace jwt {
     namespace detail {
-        class OnLeave : public vector<function<void()>> {
+        // Frees whichever OpenSSL handle it's given. Being empty it makes OpenSSLHandle the size of a pointer.
+        struct OpenSSLDeleter {
+            void operator()(BIO* bio) const {
+                BIO_free_all(bio);
+            }
+
+            void operator()(EVP_PKEY* pkey) const {
+                EVP_PKEY_free(pkey);
+            }
+
+            void operator()(EVP_MD_CTX* mdctx) const {
+                EVP_MD_CTX_destroy(mdctx);
+            }
+        };
+
+        template <typename T>
+        using OpenSSLHandle = unique_ptr<T, OpenSSLDeleter>;
+
+        thread_local unsigned long firstError{ 0 };
+
+        // Drains OpenSSL's error queue when it goes out of scope so failures don't leave stale errors
+        // behind for whatever else runs on the thread, remembering the first one.
+        class ErrorQueueGuard {
         public:
-            ~OnLeave() {
-                for (auto& fn : *this) {
-                    fn();
+            ErrorQueueGuard() {
+                firstError = 0;
+            }
+
+            ~ErrorQueueGuard() {
+                auto error = ERR_peek_error();
+
+                if (error != 0) {
+                    firstError = error;
+                    ERR_clear_error();
                 }
             }
         };
@@ -35,22 +73,19 @@ namespace jwt {
         }
 
         string b64encode(const uint8_t* data, size_t len) {
-            auto b64 = BIO_new(BIO_f_base64());
-            auto bio = BIO_new(BIO_s_mem());
+            ErrorQueueGuard errors{};
 
-            bio = BIO_push(b64, bio);
+            OpenSSLHandle<BIO> bio{ BIO_push(BIO_new(BIO_f_base64()), BIO_new(BIO_s_mem())) };
 
-            BIO_set_flags(bio, BIO_FLAGS_BASE64_NO_NL);
-            BIO_write(bio, data, len);
-            BIO_flush(bio);
+            BIO_set_flags(bio.get(), BIO_FLAGS_BASE64_NO_NL);
+            BIO_write(bio.get(), data, len);
+            BIO_flush(bio.get());
 
             BUF_MEM* buf = nullptr;
 
-            BIO_get_mem_ptr(bio, &buf);
-
-            string s{ buf->data };
+            BIO_get_mem_ptr(bio.get(), &buf);
 
-            BIO_free_all(bio);
+            string s{ buf->data, buf->length };
 
             // Convert it to base64url.
             s = s.substr(0, s.find_last_not_of("=") + 1);
@@ -61,6 +96,8 @@ namespace jwt {
         }
 
         vector<uint8_t> b64decode(string str) {
+            ErrorQueueGuard errors{};
+
             // Convert it from base64url back to normal base64.
             size_t padding{ 0 };
 
@@ -88,274 +125,904 @@ namespace jwt {
             size_t len{ (str.length() * 3) / 4 - padding };
             vector<uint8_t> buf(len);
 
-            auto bio = BIO_new_mem_buf((void*)str.c_str(), -1);
-            auto b64 = BIO_new(BIO_f_base64());
-
-            bio = BIO_push(b64, bio);
+            OpenSSLHandle<BIO> bio{ BIO_push(BIO_new(BIO_f_base64()), BIO_new_mem_buf((void*)str.c_str(), -1)) };
 
-            BIO_set_flags(bio, BIO_FLAGS_BASE64_NO_NL);
-            BIO_read(bio, buf.data(), str.length());
-            BIO_free_all(bio);
+            BIO_set_flags(bio.get(), BIO_FLAGS_BASE64_NO_NL);
+            BIO_read(bio.get(), buf.data(), str.length());
 
             return buf;
         }
-    }
 
-    #define SCOPE_EXIT(x) do { onLeave.push_back([&]() { x; }); } while(0)
+        const int8_t b64urlTable[256] = {
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1,
+            52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+            -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+            15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, 63,
+            -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+            41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        };
+
+        // Decodes a whole number of 4 character quanta, or a trailing 2 or 3 character one.
+        size_t b64urlDecodeBlock(const char* src, size_t len, char* dst) {
+            auto out = dst;
 
-    string signHMAC(const string& str, const string& key, const string& alg) {
-        const EVP_MD* evp = nullptr;
+            for (; len >= 4; src += 4, len -= 4) {
+                uint32_t bits = (b64urlTable[(uint8_t)src[0]] << 18) | (b64urlTable[(uint8_t)src[1]] << 12) |
+                    (b64urlTable[(uint8_t)src[2]] << 6) | b64urlTable[(uint8_t)src[3]];
+
+                *out++ = (char)(bits >> 16);
+                *out++ = (char)(bits >> 8);
+                *out++ = (char)bits;
+            }
 
-        if (alg == "HS256") {
-            evp = EVP_sha256();
+            if (len >= 2) {
+                uint32_t bits = (b64urlTable[(uint8_t)src[0]] << 18) | (b64urlTable[(uint8_t)src[1]] << 12);
+
+                if (len == 3) {
+                    bits |= b64urlTable[(uint8_t)src[2]] << 6;
+                }
+
+                *out++ = (char)(bits >> 16);
+
+                if (len == 3) {
+                    *out++ = (char)(bits >> 8);
+                }
+            }
+
+            return out - dst;
         }
-        else if (alg == "HS384") {
-            evp = EVP_sha384();
+
+        bool Base64UrlIterator::valid(const char* pos, const char* end) {
+            if ((end - pos) % 4 == 1) {
+                return false;
+            }
+
+            for (; pos < end; ++pos) {
+                if (b64urlTable[(uint8_t)*pos] < 0) {
+                    return false;
+                }
+            }
+
+            return true;
         }
-        else if (alg == "HS512") {
-            evp = EVP_sha512();
+
+        void Base64UrlIterator::fill() {
+            // 64 characters decode to a full 48 byte block.
+            size_t len = min<size_t>(m_end - m_pos, 64);
+
+            m_next = m_pos + len;
+            m_index = 0;
+            m_count = (uint8_t)b64urlDecodeBlock(m_pos, len, m_block);
+
+            if (m_count == 0) {
+                m_pos = m_end;
+            }
         }
-        else {
-            return string{};
+
+        const char b64urlAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+        void b64urlQuantum(const uint8_t* src, char* dst) {
+            uint32_t bits = (src[0] << 16) | (src[1] << 8) | src[2];
+
+            dst[0] = b64urlAlphabet[(bits >> 18) & 0x3F];
+            dst[1] = b64urlAlphabet[(bits >> 12) & 0x3F];
+            dst[2] = b64urlAlphabet[(bits >> 6) & 0x3F];
+            dst[3] = b64urlAlphabet[bits & 0x3F];
         }
 
-        vector<uint8_t> out(EVP_MAX_MD_SIZE);
-        unsigned int len = 0;
+        // Base64url encodes [src, src + len) into dst without padding. dst needs room for
+        // (len * 4 + 2) / 3 characters. Returns how many were written.
+        size_t b64urlEncode(const uint8_t* src, size_t len, char* dst) {
+            auto out = dst;
 
-        HMAC(evp, key.c_str(), key.length(), (const unsigned char*)str.c_str(), str.length(), out.data(), &len);
+            for (; len >= 3; src += 3, len -= 3, out += 4) {
+                b64urlQuantum(src, out);
+            }
 
-        return detail::b64encode(out.data(), len);
-    }
+            if (len != 0) {
+                uint8_t rest[3]{};
+                char quantum[4];
 
-    string signPEM(const string& str, const string& key, const string& alg) {
-        detail::OnLeave onLeave{};
-        const EVP_MD* evp = nullptr;
+                memcpy(rest, src, len);
+                b64urlQuantum(rest, quantum);
+                memcpy(out, quantum, len + 1);
+                out += len + 1;
+            }
 
-        if (alg == "RS256") {
-            evp = EVP_sha256();
+            return out - dst;
         }
-        else if (alg == "RS384") {
-            evp = EVP_sha384();
+
+        // Appends the base64url encoding of [src, src + len) to out.
+        template <typename String>
+        void b64urlAppend(const uint8_t* src, size_t len, String& out) {
+            auto pos = out.size();
+
+            out.resize(pos + (len * 4 + 2) / 3);
+            b64urlEncode(src, len, &out[0] + pos);
         }
-        else if (alg == "RS512") {
-            evp = EVP_sha512();
+
+        // Stream buffer that base64url encodes whatever is written to it straight onto the end of a
+        // string, so json can be encoded through its ostream operator without being dumped into a
+        // string of its own first.
+        template <typename String>
+        class Base64UrlBuf : public streambuf {
+        public:
+            explicit Base64UrlBuf(String& out) : m_out(out) {}
+
+            // Writes out whatever is left without padding.
+            void finish() {
+                b64urlAppend(m_pending, m_count, m_out);
+                m_count = 0;
+            }
+
+        protected:
+            int_type overflow(int_type c) override {
+                if (traits_type::eq_int_type(c, traits_type::eof())) {
+                    return traits_type::not_eof(c);
+                }
+
+                put((uint8_t)traits_type::to_char_type(c));
+
+                return c;
+            }
+
+            streamsize xsputn(const char* s, streamsize count) override {
+                auto length = (size_t)count;
+
+                // Top up any partial group first.
+                while (m_count != 0 && length != 0) {
+                    put((uint8_t)*s++);
+                    --length;
+                }
+
+                auto whole = length - length % 3;
+
+                b64urlAppend((const uint8_t*)s, whole, m_out);
+                s += whole;
+                length -= whole;
+
+                while (length != 0) {
+                    put((uint8_t)*s++);
+                    --length;
+                }
+
+                return count;
+            }
+
+        private:
+            void put(uint8_t c) {
+                m_pending[m_count++] = c;
+
+                if (m_count == 3) {
+                    finish();
+                }
+            }
+
+            String& m_out;
+            uint8_t m_pending[3]{};
+            size_t m_count{ 0 };
+        };
+
+        // Appends the base64url encoding of value.dump() to out.
+        template <typename String>
+        void b64urlDump(const json& value, String& out) {
+            Base64UrlBuf<String> buf{ out };
+            ostream stream{ &buf };
+
+            // Let a failed append throw rather than leave a truncated segment behind.
+            stream.exceptions(ios::badbit);
+            stream << value;
+            buf.finish();
         }
-        else if (alg == "ES256") {
-            evp = EVP_sha256();
+
+        template <typename String>
+        bool b64urlDecodeInto(const char* begin, const char* end, String& out) {
+            if (!Base64UrlIterator::valid(begin, end)) {
+                return false;
+            }
+
+            out.resize((end - begin) * 3 / 4);
+            out.resize(b64urlDecodeBlock(begin, end - begin, &out[0]));
+
+            return true;
         }
-        else if (alg == "ES384") {
-            evp = EVP_sha384();
+
+        bool b64urlDecode(const char* begin, const char* end, string& out) {
+            return b64urlDecodeInto(begin, end, out);
         }
-        else if (alg == "ES512") {
-            evp = EVP_sha512();
+    }
+
+    namespace detail {
+        uint32_t hashBytes(const char* data, size_t len) {
+            uint32_t hash = 2166136261u;
+
+            for (size_t i = 0; i < len; ++i) {
+                hash ^= (uint8_t)data[i];
+                hash *= 16777619u;
+            }
+
+            return hash;
         }
-        else {
-            return string{};
+    }
+
+    Alg algFromName(const string& alg) {
+        static const Alg algs[] = { Alg::None, Alg::HS256, Alg::HS384, Alg::HS512, Alg::RS256, Alg::RS384, Alg::RS512, Alg::ES256, Alg::ES384, Alg::ES512 };
+
+        for (auto theAlg : algs) {
+            if (alg == algName(theAlg)) {
+                return theAlg;
+            }
         }
 
-        auto bufkey = BIO_new_mem_buf((void*)key.c_str(), key.length());
-        SCOPE_EXIT(if (bufkey) BIO_free(bufkey));
+        return Alg::Unknown;
+    }
 
-        if (!bufkey) {
-            return string{};
+    unsigned long lastOpenSSLError() {
+        return detail::firstError;
+    }
+
+    const char* algName(Alg alg) {
+        switch (alg) {
+        case Alg::None: return "none";
+        case Alg::HS256: return "HS256";
+        case Alg::HS384: return "HS384";
+        case Alg::HS512: return "HS512";
+        case Alg::RS256: return "RS256";
+        case Alg::RS384: return "RS384";
+        case Alg::RS512: return "RS512";
+        case Alg::ES256: return "ES256";
+        case Alg::ES384: return "ES384";
+        case Alg::ES512: return "ES512";
+        default: return "";
         }
+    }
 
-        // Use OpenSSL's default passphrase callbacks if needed.
-        auto pkey = PEM_read_bio_PrivateKey(bufkey, nullptr, nullptr, nullptr);
-        SCOPE_EXIT(if (pkey) EVP_PKEY_free(pkey));
+    namespace detail {
+        // The digest for an HS alg, or nullptr if it isn't one.
+        const EVP_MD* hmacDigest(const string& alg) {
+            if (alg == "HS256") {
+                return EVP_sha256();
+            }
+            else if (alg == "HS384") {
+                return EVP_sha384();
+            }
+            else if (alg == "HS512") {
+                return EVP_sha512();
+            }
 
-        if (!pkey) {
-            return string{};
+            return nullptr;
         }
 
-        auto mdctx = EVP_MD_CTX_create();
-        SCOPE_EXIT(if (mdctx) EVP_MD_CTX_destroy(mdctx));
+        // The digest for an RS or ES alg, or nullptr if it isn't one.
+        const EVP_MD* pemDigest(const string& alg) {
+            if (alg == "RS256" || alg == "ES256") {
+                return EVP_sha256();
+            }
+            else if (alg == "RS384" || alg == "ES384") {
+                return EVP_sha384();
+            }
+            else if (alg == "RS512" || alg == "ES512") {
+                return EVP_sha512();
+            }
 
-        if (!mdctx) {
-            return string{};
+            return nullptr;
         }
 
-        // Initialize the digest sign operation.
-        if (EVP_DigestSignInit(mdctx, nullptr, evp, nullptr, pkey) != 1) {
-            return string{};
+        // Computes the HMAC of [data, data + len) into mac, which has room for EVP_MAX_MD_SIZE bytes.
+        // Returns its length, or 0 on failure.
+        unsigned int signHMAC(const char* data, size_t len, const string& key, const EVP_MD* evp, uint8_t* mac) {
+            ErrorQueueGuard errors{};
+            JWT_STAGE(Signature);
+
+            unsigned int macLen = 0;
+
+            if (HMAC(evp, key.c_str(), key.length(), (const unsigned char*)data, len, mac, &macLen) == nullptr) {
+                return 0;
+            }
+
+            return macLen;
         }
 
-        // Update the digest sign with the message.
-        if (EVP_DigestSignUpdate(mdctx, str.c_str(), str.length()) != 1) {
-            return string{};
+        // Signs [data, data + len) with the PEM private key, storing the raw signature in sig.
+        // Returns false on failure.
+        bool signPEM(const char* data, size_t len, const string& key, const EVP_MD* evp, ArenaString& sig) {
+            ErrorQueueGuard errors{};
+
+            OpenSSLHandle<BIO> bufkey{ BIO_new_mem_buf((void*)key.c_str(), key.length()) };
+
+            if (!bufkey) {
+                return false;
+            }
+
+            OpenSSLHandle<EVP_PKEY> pkey{};
+
+            {
+                JWT_STAGE(Key);
+
+                // Use OpenSSL's default passphrase callbacks if needed.
+                pkey.reset(PEM_read_bio_PrivateKey(bufkey.get(), nullptr, nullptr, nullptr));
+            }
+
+            if (!pkey) {
+                JWT_OUTCOME(BadKey);
+                return false;
+            }
+
+            JWT_STAGE(Signature);
+
+            OpenSSLHandle<EVP_MD_CTX> mdctx{ EVP_MD_CTX_create() };
+
+            if (!mdctx) {
+                return false;
+            }
+
+            // Initialize the digest sign operation.
+            if (EVP_DigestSignInit(mdctx.get(), nullptr, evp, nullptr, pkey.get()) != 1) {
+                return false;
+            }
+
+            // Update the digest sign with the message.
+            if (EVP_DigestSignUpdate(mdctx.get(), data, len) != 1) {
+                return false;
+            }
+
+            // Determin the size of the finalized digest sign.
+            size_t siglen = 0;
+
+            if (EVP_DigestSignFinal(mdctx.get(), nullptr, &siglen) != 1) {
+                return false;
+            }
+
+            // Finalize it.
+            sig.resize(siglen);
+
+            if (EVP_DigestSignFinal(mdctx.get(), (unsigned char*)&sig[0], &siglen) != 1) {
+                return false;
+            }
+
+            sig.resize(siglen);
+
+            return true;
         }
 
-        // Determin the size of the finalized digest sign.
-        size_t siglen = 0;
+        // Checks sig, a raw signature, over [data, data + len) with the PEM public key. Returns false
+        // on failure.
+        bool verifyPEM(const char* data, size_t len, const uint8_t* sig, size_t siglen, const string& key, const EVP_MD* evp) {
+            ErrorQueueGuard errors{};
 
-        if (EVP_DigestSignFinal(mdctx, nullptr, &siglen) != 1) {
-            return string{};
+            OpenSSLHandle<BIO> bufkey{ BIO_new_mem_buf((void*)key.c_str(), key.length()) };
+
+            if (!bufkey) {
+                return false;
+            }
+
+            OpenSSLHandle<EVP_PKEY> pkey{};
+
+            {
+                JWT_STAGE(Key);
+
+                // Use OpenSSL's default passphrase callbacks if needed.
+                pkey.reset(PEM_read_bio_PUBKEY(bufkey.get(), nullptr, nullptr, nullptr));
+            }
+
+            if (!pkey) {
+                JWT_OUTCOME(BadKey);
+                return false;
+            }
+
+            JWT_STAGE(Signature);
+
+            OpenSSLHandle<EVP_MD_CTX> mdctx{ EVP_MD_CTX_create() };
+
+            if (!mdctx) {
+                return false;
+            }
+
+            if (EVP_DigestVerifyInit(mdctx.get(), nullptr, evp, nullptr, pkey.get()) != 1) {
+                return false;
+            }
+
+            if (EVP_DigestVerifyUpdate(mdctx.get(), data, len) != 1) {
+                return false;
+            }
+
+            if (EVP_DigestVerifyFinal(mdctx.get(), sig, siglen) != 1) {
+                JWT_OUTCOME(BadSignature);
+                return false;
+            }
+
+            return true;
         }
 
-        // Finalize it.
-        vector<uint8_t> sig(siglen);
+        string signHMAC(const string& str, const string& key, const string& alg) {
+            auto evp = hmacDigest(alg);
 
-        if (EVP_DigestSignFinal(mdctx, sig.data(), &siglen) != 1) {
-            return string{};
+            if (evp == nullptr) {
+                return string{};
+            }
+
+            uint8_t mac[EVP_MAX_MD_SIZE];
+            auto len = signHMAC(str.data(), str.length(), key, evp, mac);
+
+            return b64encode(mac, len);
         }
 
-        // For RSA, we are done.
-        return detail::b64encode(sig.data(), siglen);
-    }
+        string signPEM(const string& str, const string& key, const string& alg) {
+            auto evp = pemDigest(alg);
+            ArenaString sig{};
+
+            if (evp == nullptr || !signPEM(str.data(), str.length(), key, evp, sig)) {
+                return string{};
+            }
+
+            // For RSA, we are done.
+            return b64encode((const uint8_t*)sig.data(), sig.size());
+        }
+
+        bool verifyPEM(const string& str, const string& b64sig, const string& key, const string& alg) {
+            auto evp = pemDigest(alg);
+
+            if (evp == nullptr) {
+                return false;
+            }
+
+            auto sig = b64decode(b64sig);
+
+            if (sig.empty()) {
+                return false;
+            }
+
+            return verifyPEM(str.data(), str.length(), sig.data(), sig.size(), key, evp);
+        }
+
+        // Builds the token encode returns in token: the header and payload base64url encoded straight
+        // onto it and then the signature, with no copies of any of them along the way. The header is
+        // written out as a json object of the alg and typ dumps. Returns false on failure.
+        template <typename String>
+        bool buildToken(const json& payload, const string& key, const string& alg, String& token) {
+            // Default to the HS256 alg if none is supplied.
+            const string theAlg{ alg.empty() ? "HS256" : alg };
+
+            JWT_ALG(theAlg);
 
-    bool verifyPEM(const string& str, const string& b64sig, const string& key, const string& alg) {
-        detail::OnLeave onLeave{};
-        const EVP_MD* evp = nullptr;
+            auto parsed = algFromName(theAlg);
+
+            if (parsed == Alg::Unknown) {
+                return false;
+            }
+
+            {
+                JWT_STAGE(Serialize);
+
+                static const char prefix[] = "{\"alg\":\"";
+                static const char suffix[] = "\",\"typ\":\"JWT\"}";
+                char header[sizeof(prefix) + sizeof(suffix) + 8];
+                auto end = header;
+
+                end = copy(prefix, prefix + sizeof(prefix) - 1, end);
+                end = copy(theAlg.begin(), theAlg.end(), end);
+                end = copy(suffix, suffix + sizeof(suffix) - 1, end);
+
+                b64urlAppend((const uint8_t*)header, end - header, token);
+                token += '.';
+                b64urlDump(payload, token);
+            }
+
+            // Sign it.
+            if (parsed == Alg::None) {
+                // Nothing to sign.
+                token += '.';
+                return true;
+            }
+
+            if (auto evp = hmacDigest(theAlg)) {
+                uint8_t mac[EVP_MAX_MD_SIZE];
+                auto len = signHMAC(token.data(), token.size(), key, evp, mac);
+
+                if (len == 0) {
+                    return false;
+                }
+
+                token += '.';
+                b64urlAppend(mac, len, token);
+                return true;
+            }
+
+            ArenaString sig{};
+
+            if (!signPEM(token.data(), token.size(), key, pemDigest(theAlg), sig)) {
+                return false;
+            }
+
+            token += '.';
+            b64urlAppend((const uint8_t*)sig.data(), sig.size(), token);
+            return true;
+        }
 
-        if (alg == "RS256") {
-            evp = EVP_sha256();
+        bool encodeToken(const json& payload, const string& key, const string& alg, ArenaString& token) {
+            return buildToken(payload, key, alg, token);
         }
-        else if (alg == "RS384") {
-            evp = EVP_sha384();
+    }
+
+    string encode(const json& payload, const string& key, const string& alg) {
+        JWT_CALL(Encode, nullptr);
+
+        string encodedToken{};
+
+        if (!detail::buildToken(payload, key, alg, encodedToken)) {
+            return string{};
         }
-        else if (alg == "RS512") {
-            evp = EVP_sha512();
+
+        JWT_OUTCOME(Ok);
+
+        return encodedToken;
+    }
+
+    namespace detail {
+        bool splitToken(const string& jwt, size_t& firstPeriod, size_t& secondPeriod) {
+            if (jwt.empty()) {
+                return false;
+            }
+
+            // Make sure the jwt we recieve looks like a jwt.
+            firstPeriod = jwt.find_first_of('.');
+            secondPeriod = jwt.find_first_of('.', firstPeriod + 1);
+
+            return firstPeriod != string::npos && secondPeriod != string::npos;
         }
-        else if (alg == "ES256") {
-            evp = EVP_sha256();
+
+        VerifyStatus signatureStatus(const string& jwt, const string& key, const string& theAlg, const set<string>& alg, size_t secondPeriod) {
+            JWT_ALG(theAlg);
+
+            // Make sure no key is supplied if the alg is none.
+            if (theAlg == "none" && !key.empty()) {
+                JWT_OUTCOME(AlgRejected);
+                return VerifyStatus::AlgNotAllowed;
+            }
+            // Make sure the alg supplied is one we expect.
+            else if (alg.count(theAlg) == 0 && !alg.empty()) {
+                JWT_OUTCOME(AlgRejected);
+                return VerifyStatus::AlgNotAllowed;
+            }
+
+            // The signed part and the signature are checked where they are in the jwt, without copies.
+            auto signature = jwt.data() + secondPeriod + 1;
+            auto signatureLen = jwt.length() - secondPeriod - 1;
+
+            // Verify the signature.
+            auto verified = true;
+
+            if (theAlg == "none") {
+                // Nothing to do, no verification needed.
+            }
+            else if (theAlg.find("HS") != string::npos) {
+                auto evp = hmacDigest(theAlg);
+                uint8_t mac[EVP_MAX_MD_SIZE];
+                char calculatedSignature[(EVP_MAX_MD_SIZE * 4 + 2) / 3];
+                auto macLen = evp != nullptr ? signHMAC(jwt.data(), secondPeriod, key, evp, mac) : 0;
+                auto calculatedLen = b64urlEncode(mac, macLen, calculatedSignature);
+
+                if (macLen == 0 || signatureLen != calculatedLen || memcmp(signature, calculatedSignature, calculatedLen) != 0) {
+                    JWT_OUTCOME(BadSignature);
+                    verified = false;
+                }
+            }
+            else {
+                // The raw signature is scratch, in the arena if there's an ArenaScope.
+                auto evp = pemDigest(theAlg);
+                ArenaString sig{};
+
+                verified = evp != nullptr && b64urlDecodeInto(signature, signature + signatureLen, sig) && !sig.empty()
+                    && verifyPEM(jwt.data(), secondPeriod, (const uint8_t*)sig.data(), sig.size(), key, evp);
+            }
+
+            JWT_SIGNATURE(verified);
+
+            return verified ? VerifyStatus::Ok : VerifyStatus::InvalidSignature;
         }
-        else if (alg == "ES384") {
-            evp = EVP_sha384();
+
+        bool verifySignature(const string& jwt, const string& key, const string& theAlg, const set<string>& alg, size_t secondPeriod) {
+            return signatureStatus(jwt, key, theAlg, alg, secondPeriod) == VerifyStatus::Ok;
         }
-        else if (alg == "ES512") {
-            evp = EVP_sha512();
+
+        bool decodeHeader(const string& jwt, string& header) {
+            size_t firstPeriod{};
+            size_t secondPeriod{};
+
+            if (!splitToken(jwt, firstPeriod, secondPeriod)) {
+                return false;
+            }
+
+            return b64urlDecode(jwt.data(), jwt.data() + firstPeriod, header);
         }
-        else {
-            return false;
+
+        bool verifyPayload(const string& jwt, const string& key, const string& theAlg, const set<string>& alg, string& payload) {
+            size_t firstPeriod{};
+            size_t secondPeriod{};
+
+            if (!splitToken(jwt, firstPeriod, secondPeriod) || !verifySignature(jwt, key, theAlg, alg, secondPeriod)) {
+                return false;
+            }
+
+            // Decode the payload since the jwt has been verified.
+            return b64urlDecode(jwt.data() + firstPeriod + 1, jwt.data() + secondPeriod, payload);
         }
 
-        auto sig = detail::b64decode(b64sig);
-        auto siglen = sig.size();
+        bool verifyToken(const string& jwt, const string& key, const set<string>& alg, const char*& payloadBegin, const char*& payloadEnd) {
+            size_t firstPeriod{};
+            size_t secondPeriod{};
+
+            if (!splitToken(jwt, firstPeriod, secondPeriod)) {
+                return false;
+            }
+
+            // Parse the header straight out of its encoded form so we can get the alg used by the jwt.
+            auto headerBegin = jwt.data();
+            auto headerEnd = jwt.data() + firstPeriod;
+
+            if (!Base64UrlIterator::valid(headerBegin, headerEnd)) {
+                return false;
+            }
+
+            json header{};
+
+            {
+                JWT_STAGE(Header);
+                header = json::parse(Base64UrlIterator{ headerBegin, headerEnd }, Base64UrlIterator{ headerEnd, headerEnd });
+            }
+
+            const string& theAlg = header["alg"];
+
+            if (!verifySignature(jwt, key, theAlg, alg, secondPeriod)) {
+                return false;
+            }
 
-        if (sig.empty()) {
-            return false;
+            payloadBegin = jwt.data() + firstPeriod + 1;
+            payloadEnd = jwt.data() + secondPeriod;
+
+            return Base64UrlIterator::valid(payloadBegin, payloadEnd);
         }
 
-        auto bufkey = BIO_new_mem_buf((void*)key.c_str(), key.length());
-        SCOPE_EXIT(if (bufkey) BIO_free(bufkey));
+        bool decodePayload(const string& jwt, const string& key, const set<string>& alg, string& payload) {
+            const char* payloadBegin{};
+            const char* payloadEnd{};
+
+            if (!verifyToken(jwt, key, alg, payloadBegin, payloadEnd)) {
+                return false;
+            }
 
-        if (!bufkey) {
-            return false;
+            return b64urlDecode(payloadBegin, payloadEnd, payload);
         }
+    }
 
-        // Use OpenSSL's default passphrase callbacks if needed.
-        auto pkey = PEM_read_bio_PUBKEY(bufkey, nullptr, nullptr, nullptr);
-        SCOPE_EXIT(if (pkey) EVP_PKEY_free(pkey));
+    json decode(const string& jwt, const string& key, const set<string>& alg) {
+        JWT_CALL(Decode, &jwt);
 
-        if (!pkey) {
-            return false;
+        const char* payloadBegin{};
+        const char* payloadEnd{};
+
+        if (!detail::verifyToken(jwt, key, alg, payloadBegin, payloadEnd)) {
+            return json{};
         }
 
-        auto mdctx = EVP_MD_CTX_create();
-        SCOPE_EXIT(if (mdctx) EVP_MD_CTX_destroy(mdctx));
+        JWT_STAGE(Payload);
+
+        // Feed the payload to the parser as it's decoded rather than decoding it up front.
+        auto payload = json::parse(detail::Base64UrlIterator{ payloadBegin, payloadEnd }, detail::Base64UrlIterator{ payloadEnd, payloadEnd });
+
+        JWT_OUTCOME(Ok);
 
-        if (EVP_DigestVerifyInit(mdctx, nullptr, evp, nullptr, pkey) != 1) {
-            return false;
+        return payload;
+    }
+
+    namespace detail {
+        VerifyStatus headerAlg(const string& jwt, string& theAlg, size_t& firstPeriod, size_t& secondPeriod) {
+            static const char* const names[] = { "alg" };
+            StringView name{};
+            char storage[16];
+            bool truncated = false;
+
+            if (!splitToken(jwt, firstPeriod, secondPeriod)) {
+                return VerifyStatus::Malformed;
+            }
+
+            // Only pull the alg out of the header, the signature covers the rest of it.
+            {
+                JWT_STAGE(Header);
+
+                // No supported alg comes close to filling storage, so one that doesn't fit isn't supported.
+                if (!peekSegment(jwt.data(), jwt.data() + firstPeriod, firstPeriod, names, &name, 1, storage, sizeof(storage), &truncated)) {
+                    if (truncated) {
+                        JWT_OUTCOME(AlgRejected);
+                        return VerifyStatus::UnsupportedAlg;
+                    }
+
+                    return VerifyStatus::Malformed;
+                }
+            }
+
+            if (name.empty()) {
+                return VerifyStatus::Malformed;
+            }
+
+            theAlg = name.str();
+
+            if (algFromName(theAlg) == Alg::Unknown) {
+                JWT_OUTCOME(AlgRejected);
+                return VerifyStatus::UnsupportedAlg;
+            }
+
+            return VerifyStatus::Ok;
         }
+    }
+
+    VerifyStatus verify(const string& jwt, const string& key, const set<string>& alg) {
+        JWT_CALL(Verify, &jwt);
+
+        string theAlg{};
+        size_t firstPeriod{};
+        size_t secondPeriod{};
+        auto status = detail::headerAlg(jwt, theAlg, firstPeriod, secondPeriod);
 
-        if (EVP_DigestVerifyUpdate(mdctx, str.c_str(), str.length()) != 1) {
-            return false;
+        if (status == VerifyStatus::Ok) {
+            status = detail::signatureStatus(jwt, key, theAlg, alg, secondPeriod);
         }
 
-        if (EVP_DigestVerifyFinal(mdctx, sig.data(), siglen) != 1) {
-            return false;
+        if (status == VerifyStatus::Ok) {
+            JWT_OUTCOME(Ok);
         }
 
-        return true;
+        return status;
     }
 
-    string encode(const json& payload, const string& key, const string& alg) {
-        // Create a JWT header defaulting to the HS256 alg if none is supplied.
-        json header{
-            {"typ", "JWT"},
-            {"alg", alg.empty() ? "HS256" : alg }
+    namespace detail {
+        struct LimitCounters {
+            atomic<uint64_t> tokenSize{ 0 };
+            atomic<uint64_t> headerSize{ 0 };
+            atomic<uint64_t> payloadSize{ 0 };
+            atomic<uint64_t> depth{ 0 };
+            atomic<uint64_t> claims{ 0 };
         };
-        auto headerStr = header.dump();
-        auto encodedHeader = detail::b64encode((const uint8_t*)headerStr.c_str(), headerStr.length());
 
-        // Encode the payload.
-        auto payloadStr = payload.dump();
-        auto encodedPayload = detail::b64encode((const uint8_t*)payloadStr.c_str(), payloadStr.length());
+        LimitCounters limitCounters{};
 
-        // Sign it and return the final JWT.
-        auto encodedToken = encodedHeader + "." + encodedPayload;
-        const string& theAlg = header["alg"];
-        string signature{};
+        bool exceeded(Limit limit) {
+            JWT_OUTCOME(LimitExceeded);
 
-        if (theAlg == "none") {
-            // Nothing to sign.
-        }
-        else if (theAlg.find("HS") != string::npos) {
-            signature = signHMAC(encodedToken, key, theAlg);
+            switch (limit) {
+            case Limit::TokenSize:
+                limitCounters.tokenSize.fetch_add(1, memory_order_relaxed);
+                break;
+            case Limit::HeaderSize:
+                limitCounters.headerSize.fetch_add(1, memory_order_relaxed);
+                break;
+            case Limit::PayloadSize:
+                limitCounters.payloadSize.fetch_add(1, memory_order_relaxed);
+                break;
+            case Limit::Depth:
+                limitCounters.depth.fetch_add(1, memory_order_relaxed);
+                break;
+            case Limit::Claims:
+                limitCounters.claims.fetch_add(1, memory_order_relaxed);
+                break;
+            }
+
+            return true;
         }
-        else {
-            signature = signPEM(encodedToken, key, theAlg);
+
+        // The most a base64url segment of this length can decode to.
+        size_t decodedSize(size_t encodedSize) {
+            return (encodedSize * 3 + 3) / 4;
         }
 
-        if (theAlg != "none" && signature.empty()) {
-            return string{};
+        bool withinLimits(const std::string& jwt, const Limits& limits, bool checkPayload) {
+            if (jwt.length() > limits.maxTokenSize) {
+                return !exceeded(Limit::TokenSize);
+            }
+
+            size_t firstPeriod{};
+            size_t secondPeriod{};
+
+            // Leave malformed tokens to the checks after this.
+            if (!splitToken(jwt, firstPeriod, secondPeriod)) {
+                return true;
+            }
+
+            if (decodedSize(firstPeriod) > limits.maxHeaderSize) {
+                return !exceeded(Limit::HeaderSize);
+            }
+
+            if (checkPayload && decodedSize(secondPeriod - firstPeriod - 1) > limits.maxPayloadSize) {
+                return !exceeded(Limit::PayloadSize);
+            }
+
+            return true;
         }
+    }
+
+    LimitViolations limitViolations() {
+        auto& counters = detail::limitCounters;
+        LimitViolations violations{};
+
+        violations.tokenSize = counters.tokenSize.load(memory_order_relaxed);
+        violations.headerSize = counters.headerSize.load(memory_order_relaxed);
+        violations.payloadSize = counters.payloadSize.load(memory_order_relaxed);
+        violations.depth = counters.depth.load(memory_order_relaxed);
+        violations.claims = counters.claims.load(memory_order_relaxed);
 
-        return encodedToken + "." + signature;
+        return violations;
     }
 
-    json decode(const string& jwt, const string& key, const set<string>& alg) {
-        if (jwt.empty()) {
-            return json{};
+    VerifyStatus verify(const string& jwt, const string& key, const Limits& limits, const set<string>& alg) {
+        JWT_CALL(Verify, &jwt);
+
+        // The payload isn't decoded so its size doesn't matter beyond the token's.
+        if (!detail::withinLimits(jwt, limits, false)) {
+            return VerifyStatus::LimitExceeded;
         }
 
-        // Make sure the jwt we recieve looks like a jwt.
-        auto firstPeriod = jwt.find_first_of('.');
-        auto secondPeriod = jwt.find_first_of('.', firstPeriod + 1);
+        return verify(jwt, key, alg);
+    }
+
+    json decode(const string& jwt, const string& key, const Limits& limits, VerifyStatus& status, const set<string>& alg) {
+        JWT_CALL(Decode, &jwt);
 
-        if (firstPeriod == string::npos || secondPeriod == string::npos) {
+        if (!detail::withinLimits(jwt, limits, true)) {
+            status = VerifyStatus::LimitExceeded;
             return json{};
         }
 
-        // Decode the header so we can get the alg used by the jwt.
-        auto decodedHeader = detail::b64decode(jwt.substr(0, firstPeriod));
-        string decodedHeaderStr{ decodedHeader.begin(), decodedHeader.end() };
-        auto header = json::parse(decodedHeaderStr.c_str());
-        const string& theAlg = header["alg"];
+        string theAlg{};
+        size_t firstPeriod{};
+        size_t secondPeriod{};
 
-        // Make sure no key is supplied if the alg is none.
-        if (theAlg == "none" && !key.empty()) {
-            return json{};
+        status = detail::headerAlg(jwt, theAlg, firstPeriod, secondPeriod);
+
+        if (status == VerifyStatus::Ok) {
+            status = detail::signatureStatus(jwt, key, theAlg, alg, secondPeriod);
         }
-        // Make sure the alg supplied is one we expect.
-        else if (alg.count(theAlg) == 0 && !alg.empty()) {
+
+        if (status != VerifyStatus::Ok) {
             return json{};
         }
 
-        auto encodedToken = jwt.substr(0, secondPeriod);
-        auto signature = jwt.substr(secondPeriod + 1);
+        auto payloadBegin = jwt.data() + firstPeriod + 1;
+        auto payloadEnd = jwt.data() + secondPeriod;
 
-        // Verify the signature.
-        if (theAlg == "none") {
-            // Nothing to do, no verification needed.
+        if (!detail::Base64UrlIterator::valid(payloadBegin, payloadEnd)) {
+            status = VerifyStatus::Malformed;
+            JWT_OUTCOME(Malformed);
+            return json{};
         }
-        else if (theAlg.find("HS") != string::npos) {
-            auto calculatedSignature = signHMAC(encodedToken, key, theAlg);
 
-            if (signature != calculatedSignature || calculatedSignature.empty()) {
-                return json{};
+        JWT_STAGE(Payload);
+
+        json payload{};
+        detail::LimitedSax<json> sax{ payload, limits };
+
+        if (!json::sax_parse(detail::Base64UrlIterator{ payloadBegin, payloadEnd }, detail::Base64UrlIterator{ payloadEnd, payloadEnd }, &sax)) {
+            if (sax.limitExceeded()) {
+                status = VerifyStatus::LimitExceeded;
             }
-        }
-        else {
-            if (!verifyPEM(encodedToken, signature, key, theAlg)) {
-                return json{};
+            else {
+                status = VerifyStatus::Malformed;
+                JWT_OUTCOME(Malformed);
             }
+
+            return json{};
         }
 
-        // Decode the payload since the jwt has been verified.
-        auto decodedPayload = detail::b64decode(jwt.substr(firstPeriod + 1, secondPeriod - firstPeriod - 1));
-        string decodedPayloadStr{ decodedPayload.begin(), decodedPayload.end() };
-        auto payload = json::parse(decodedPayloadStr.c_str());
+        JWT_OUTCOME(Ok);
 
         return payload;
     }
@@ -1,14 +1,342 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iterator>
+#include <memory>
 #include <string>
 #include <set>
+#include <utility>
+#include <vector>
 
 #include "json.hpp"
 
 namespace jwt {
+    enum class Alg {
+        Unknown,
+        None,
+        HS256,
+        HS384,
+        HS512,
+        RS256,
+        RS384,
+        RS512,
+        ES256,
+        ES384,
+        ES512
+    };
+
+    // Returns Alg::Unknown for anything that can't be signed or verified.
+    Alg algFromName(const std::string& alg);
+
+    // Returns the name used for the alg in a jwt's header.
+    const char* algName(Alg alg);
+
+    // The first error OpenSSL reported during the last signing, verifying or base64 call on this thread,
+    // or 0 if there wasn't one. ERR_error_string_n turns it into a message. OpenSSL's own error
+    // queue is always left empty.
+    unsigned long lastOpenSSLError();
+
     // Returns an empty string on failure.
     std::string encode(const nlohmann::json& payload, const std::string& key, const std::string& alg = "");
 
-    // Returns a null json object on failure.
+    // Returns a null json object on failure. The token isn't held to any Limits, use the Limits
+    // overload for tokens from untrusted callers.
     nlohmann::json decode(const std::string& jwt, const std::string& key, const std::set<std::string>& alg = {});
+
+    enum class VerifyStatus {
+        Ok,
+        Malformed,
+        UnsupportedAlg,
+        AlgNotAllowed,
+        InvalidSignature,
+        LimitExceeded
+    };
+
+    // Checks the header's alg against the key and the allowed algs and verifies the signature. Only
+    // the alg is read from the header and the payload is never decoded or parsed, for callers that
+    // pass the jwt on untouched. The token isn't held to any Limits, use the Limits overload for
+    // tokens from untrusted callers.
+    VerifyStatus verify(const std::string& jwt, const std::string& key, const std::set<std::string>& alg = {});
+
+    // Caps on what a single token can cost. Sizes are checked before anything is decoded, depth and
+    // claims while the payload is parsed.
+    struct Limits {
+        size_t maxTokenSize{ 16384 };
+        size_t maxHeaderSize{ 1024 };
+        size_t maxPayloadSize{ 8192 };
+        size_t maxDepth{ 16 };
+        size_t maxClaims{ 256 };
+    };
+
+    // How many tokens each limit has rejected, across all threads.
+    struct LimitViolations {
+        uint64_t tokenSize{ 0 };
+        uint64_t headerSize{ 0 };
+        uint64_t payloadSize{ 0 };
+        uint64_t depth{ 0 };
+        uint64_t claims{ 0 };
+    };
+
+    LimitViolations limitViolations();
+
+    // Like verify but tokens over the limits are rejected with VerifyStatus::LimitExceeded.
+    VerifyStatus verify(const std::string& jwt, const std::string& key, const Limits& limits, const std::set<std::string>& alg = {});
+
+    // Like decode but the jwt has to stay within the limits, and a payload that isn't json is reported
+    // through status rather than thrown. Returns a null json object on failure.
+    nlohmann::json decode(const std::string& jwt, const std::string& key, const Limits& limits, VerifyStatus& status, const std::set<std::string>& alg = {});
+
+    namespace detail {
+        // FNV-1a.
+        uint32_t hashBytes(const char* data, size_t len);
+
+        // The reference base64url codec, built on OpenSSL's BIOs.
+        std::string b64encode(const uint8_t* data, size_t len);
+        std::vector<uint8_t> b64decode(std::string str);
+
+        // Return an empty string or false on failure.
+        std::string signHMAC(const std::string& str, const std::string& key, const std::string& alg);
+        std::string signPEM(const std::string& str, const std::string& key, const std::string& alg);
+        bool verifyPEM(const std::string& str, const std::string& b64sig, const std::string& key, const std::string& alg);
+
+        // Input iterator over the bytes of a base64url encoded range. It decodes a block at a time so
+        // a parser can consume the decoded bytes without them ever being stored as a whole. The range
+        // must pass valid().
+        class Base64UrlIterator {
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type = char;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const char*;
+            using reference = const char&;
+
+            Base64UrlIterator(const char* pos, const char* end) : m_pos{ pos }, m_end{ end } {
+                fill();
+            }
+
+            reference operator*() const {
+                return m_block[m_index];
+            }
+
+            Base64UrlIterator& operator++() {
+                if (++m_index == m_count) {
+                    m_pos = m_next;
+                    fill();
+                }
+
+                return *this;
+            }
+
+            Base64UrlIterator operator++(int) {
+                auto it = *this;
+                ++*this;
+                return it;
+            }
+
+            bool operator==(const Base64UrlIterator& other) const {
+                return m_pos == other.m_pos && m_index == other.m_index;
+            }
+
+            bool operator!=(const Base64UrlIterator& other) const {
+                return !(*this == other);
+            }
+
+            // Returns true if [pos, end) is unpadded base64url.
+            static bool valid(const char* pos, const char* end);
+
+        private:
+            void fill();
+
+            const char* m_pos;
+            const char* m_end;
+            const char* m_next{ nullptr };
+            char m_block[48];
+            uint8_t m_index{ 0 };
+            uint8_t m_count{ 0 };
+        };
+
+        // Base64url decodes [begin, end) into out. Returns false if it isn't valid().
+        bool b64urlDecode(const char* begin, const char* end, std::string& out);
+
+        // Checks theAlg (taken from the jwt's header) against the key and the allowed algs and
+        // verifies the signature over everything before secondPeriod. Returns AlgNotAllowed,
+        // InvalidSignature or Ok.
+        VerifyStatus signatureStatus(const std::string& jwt, const std::string& key, const std::string& theAlg, const std::set<std::string>& alg, size_t secondPeriod);
+
+        // Finds the periods of the jwt and takes the alg out of its header without parsing the rest of
+        // it. Returns Ok, Malformed or UnsupportedAlg.
+        VerifyStatus headerAlg(const std::string& jwt, std::string& theAlg, size_t& firstPeriod, size_t& secondPeriod);
+
+        // signatureStatus as a bool. Returns false on failure.
+        bool verifySignature(const std::string& jwt, const std::string& key, const std::string& theAlg, const std::set<std::string>& alg, size_t secondPeriod);
+
+        // Parses the header and verifies the signature of the jwt without decoding its payload, whose
+        // encoded bytes are returned in [payloadBegin, payloadEnd). Returns false on failure.
+        bool verifyToken(const std::string& jwt, const std::string& key, const std::set<std::string>& alg, const char*& payloadBegin, const char*& payloadEnd);
+
+        // Base64url decodes the header of the jwt. Returns false if it doesn't look like a jwt.
+        bool decodeHeader(const std::string& jwt, std::string& header);
+
+        // Checks theAlg (taken from the jwt's header) against the key and the allowed algs, verifies
+        // the signature and stores the base64url decoded payload bytes in payload.
+        // Returns false on failure.
+        bool verifyPayload(const std::string& jwt, const std::string& key, const std::string& theAlg, const std::set<std::string>& alg, std::string& payload);
+
+        // Verifies the jwt and stores its base64url decoded payload bytes in payload.
+        // Returns false on failure.
+        bool decodePayload(const std::string& jwt, const std::string& key, const std::set<std::string>& alg, std::string& payload);
+
+        enum class Limit {
+            TokenSize,
+            HeaderSize,
+            PayloadSize,
+            Depth,
+            Claims
+        };
+
+        // Counts a token rejected for going over the limit. Always returns true.
+        bool exceeded(Limit limit);
+
+        // Checks the sizes of the token and its segments, and its payload's if checkPayload, without
+        // decoding anything. Returns false if it's over the limits.
+        bool withinLimits(const std::string& jwt, const Limits& limits, bool checkPayload);
+
+        // A sax handler for json::sax_parse that builds the payload into result as parse would, with
+        // a repeated key keeping its last value, but gives up as soon as the payload nests deeper than
+        // maxDepth or has more than maxClaims claims. It only uses basic_json's public interface, and
+        // its stack comes from Json's allocator.
+        template <typename Json>
+        class LimitedSax {
+        public:
+            using string_t = typename Json::string_t;
+
+            LimitedSax(Json& result, const Limits& limits) : m_result(result), m_limits(limits) {}
+
+            bool null() {
+                return put(Json{});
+            }
+
+            bool boolean(bool value) {
+                return put(Json(value));
+            }
+
+            bool number_integer(typename Json::number_integer_t value) {
+                return put(Json(value));
+            }
+
+            bool number_unsigned(typename Json::number_unsigned_t value) {
+                return put(Json(value));
+            }
+
+            // The binary readers pass the number text as a std::string whatever string_t is, and
+            // sax_parse instantiates them for every Json, ArenaJson included.
+            template<typename String>
+            bool number_float(typename Json::number_float_t value, const String&) {
+                return put(Json(value));
+            }
+
+            bool string(string_t& value) {
+                return put(Json(std::move(value)));
+            }
+
+            // Json text has no binary values.
+            bool binary(typename Json::binary_t&) {
+                return false;
+            }
+
+            bool start_object(size_t) {
+                return enter() && open(Json::object());
+            }
+
+            bool key(string_t& value) {
+                if (m_stack.size() == 1 && ++m_claims > m_limits.maxClaims) {
+                    m_exceeded = exceeded(Limit::Claims);
+                    return false;
+                }
+
+                m_member = &(*m_stack.back())[std::move(value)];
+                return true;
+            }
+
+            bool end_object() {
+                m_stack.pop_back();
+                return true;
+            }
+
+            bool start_array(size_t) {
+                return enter() && open(Json::array());
+            }
+
+            bool end_array() {
+                m_stack.pop_back();
+                return true;
+            }
+
+            template <typename Exception>
+            bool parse_error(size_t, const std::string&, const Exception& error) {
+                m_error = std::make_exception_ptr(error);
+                return false;
+            }
+
+            bool limitExceeded() const {
+                return m_exceeded;
+            }
+
+            // What parse would have thrown for the payload, or null if it didn't stop at bad json.
+            std::exception_ptr error() const {
+                return m_error;
+            }
+
+        private:
+            bool enter() {
+                if (m_stack.size() >= m_limits.maxDepth) {
+                    m_exceeded = exceeded(Limit::Depth);
+                    return false;
+                }
+
+                return true;
+            }
+
+            // Puts the value where the parser is: the root, the end of the open array or the member
+            // whose key was just read.
+            Json* place(Json&& value) {
+                if (m_stack.empty()) {
+                    m_result = std::move(value);
+                    return &m_result;
+                }
+
+                auto& parent = *m_stack.back();
+
+                if (parent.is_array()) {
+                    parent.push_back(std::move(value));
+                    return &parent.back();
+                }
+
+                *m_member = std::move(value);
+                return m_member;
+            }
+
+            bool put(Json&& value) {
+                place(std::move(value));
+                return true;
+            }
+
+            bool open(Json&& container) {
+                m_stack.push_back(place(std::move(container)));
+                return true;
+            }
+
+            using StackAllocator = typename std::allocator_traits<typename Json::allocator_type>::template rebind_alloc<Json*>;
+
+            Json& m_result;
+            const Limits& m_limits;
+            std::vector<Json*, StackAllocator> m_stack{};
+            Json* m_member{ nullptr };
+            size_t m_claims{ 0 };
+            bool m_exceeded{ false };
+            std::exception_ptr m_error{};
+        };
+    }
 }
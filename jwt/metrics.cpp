@@ -0,0 +1,277 @@
+#include <iomanip>
+#include <locale>
+#include <sstream>
+
+#include "metrics.hpp"
+
+using namespace std;
+
+namespace jwt {
+    namespace {
+        const char* operationName(Operation operation) {
+            switch (operation) {
+            case Operation::Encode: return "encode";
+            case Operation::Decode: return "decode";
+            default: return "verify";
+            }
+        }
+
+        const char* outcomeName(Outcome outcome) {
+            switch (outcome) {
+            case Outcome::Ok: return "ok";
+            case Outcome::Malformed: return "malformed";
+            case Outcome::AlgRejected: return "alg_rejected";
+            case Outcome::BadKey: return "bad_key";
+            case Outcome::BadSignature: return "bad_signature";
+            default: return "limit_exceeded";
+            }
+        }
+
+        const char* stageName(Stage stage) {
+            switch (stage) {
+            case Stage::Header: return "header";
+            case Stage::Key: return "key";
+            case Stage::Signature: return "signature";
+            case Stage::Payload: return "payload";
+            default: return "serialize";
+            }
+        }
+
+        const char* algLabel(Alg alg) {
+            return alg == Alg::Unknown ? "unknown" : algName(alg);
+        }
+
+        // Writes whole nanoseconds as seconds without going through a double, so sums keep every
+        // digit however long the process has been up.
+        void putSeconds(ostream& out, uint64_t nanoseconds) {
+            out << nanoseconds / 1000000000 << '.' << setw(9) << setfill('0') << nanoseconds % 1000000000;
+        }
+
+        // Upper bounds of the exported histogram buckets, in seconds.
+        const double bucketBounds[] = {
+            1e-6, 2.5e-6, 5e-6, 1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4,
+            1e-3, 2.5e-3, 5e-3, 1e-2, 2.5e-2, 5e-2, 0.1, 0.25, 0.5, 1
+        };
+    }
+
+    size_t LatencyHistogram::bucketFor(uint64_t nanoseconds) {
+        if (nanoseconds < (1ull << SubBucketBits)) {
+            return (size_t)nanoseconds;
+        }
+
+        size_t top = 63;
+
+        while ((nanoseconds >> top) == 0) {
+            --top;
+        }
+
+        if (top >= MaxBits) {
+            return BucketCount - 1;
+        }
+
+        auto shift = top - SubBucketBits;
+
+        return ((shift + 1) << SubBucketBits) | (size_t)((nanoseconds >> shift) & ((1u << SubBucketBits) - 1));
+    }
+
+    uint64_t LatencyHistogram::bucketTop(size_t bucket) {
+        if (bucket < (1u << SubBucketBits)) {
+            return bucket;
+        }
+
+        auto shift = (bucket >> SubBucketBits) - 1;
+        auto sub = (uint64_t)(bucket & ((1u << SubBucketBits) - 1));
+
+        // The leading bit is implied by which power of two the bucket is in.
+        return (((1ull << SubBucketBits) | sub) << shift) + (1ull << shift) - 1;
+    }
+
+    void LatencyHistogram::record(uint64_t nanoseconds) {
+        m_buckets[bucketFor(nanoseconds)].fetch_add(1, memory_order_relaxed);
+        m_count.fetch_add(1, memory_order_relaxed);
+        m_sum.fetch_add(nanoseconds, memory_order_relaxed);
+    }
+
+    uint64_t LatencyHistogram::percentile(double p) const {
+        auto total = count();
+
+        if (total == 0) {
+            return 0;
+        }
+
+        auto target = (uint64_t)(p * total);
+
+        if (target == 0) {
+            target = 1;
+        }
+
+        uint64_t seen = 0;
+
+        for (size_t i = 0; i < BucketCount; ++i) {
+            seen += m_buckets[i].load(memory_order_relaxed);
+
+            if (seen >= target) {
+                return bucketTop(i);
+            }
+        }
+
+        return bucketTop(BucketCount - 1);
+    }
+
+    uint64_t LatencyHistogram::countAtOrBelow(uint64_t nanoseconds) const {
+        auto last = bucketFor(nanoseconds);
+        uint64_t seen = 0;
+
+        for (size_t i = 0; i <= last; ++i) {
+            seen += m_buckets[i].load(memory_order_relaxed);
+        }
+
+        return seen;
+    }
+
+    MetricsRegistry::MetricsRegistry() : m_ticksPerNanosecond{ ticksPerNanosecond() } {
+    }
+
+    MetricsRegistry::~MetricsRegistry() {
+        for (auto& histogram : m_latency) {
+            delete histogram.load();
+        }
+    }
+
+    void MetricsRegistry::record(const CallRecord& call) {
+        auto& slot = m_latency[series(call.operation, call.alg, call.outcome)];
+        auto histogram = slot.load(memory_order_acquire);
+
+        if (histogram == nullptr) {
+            auto created = new LatencyHistogram{};
+
+            if (slot.compare_exchange_strong(histogram, created, memory_order_acq_rel)) {
+                histogram = created;
+            }
+            else {
+                delete created;
+            }
+        }
+
+        histogram->record((uint64_t)(call.totalTicks / m_ticksPerNanosecond));
+
+        auto stages = &m_stageTicks[((size_t)call.operation * AlgCount + (size_t)call.alg) * StageCount];
+
+        for (size_t i = 0; i < StageCount; ++i) {
+            if (call.ticks[i] != 0) {
+                stages[i].fetch_add(call.ticks[i], memory_order_relaxed);
+            }
+        }
+
+        if (call.cacheLookup == CacheLookup::Hit) {
+            m_cacheHits.fetch_add(1, memory_order_relaxed);
+        }
+        else if (call.cacheLookup == CacheLookup::Miss) {
+            m_cacheMisses.fetch_add(1, memory_order_relaxed);
+        }
+    }
+
+    void MetricsRegistry::recordExpired(Alg alg) {
+        m_expired[(size_t)alg].fetch_add(1, memory_order_relaxed);
+    }
+
+    uint64_t MetricsRegistry::calls(Operation operation, Alg alg, Outcome outcome) const {
+        auto histogram = latency(operation, alg, outcome);
+
+        return histogram != nullptr ? histogram->count() : 0;
+    }
+
+    const LatencyHistogram* MetricsRegistry::latency(Operation operation, Alg alg, Outcome outcome) const {
+        return m_latency[series(operation, alg, outcome)].load(memory_order_acquire);
+    }
+
+    string MetricsRegistry::prometheusText() const {
+        ostringstream out{};
+
+        // Prometheus wants '.' decimals and no digit grouping whatever the global locale is.
+        out.imbue(locale::classic());
+
+        out << "# HELP jwt_call_duration_seconds Time spent in jwt encode, decode and verify calls.\n";
+        out << "# TYPE jwt_call_duration_seconds histogram\n";
+
+        for (size_t operation = 0; operation < OperationCount; ++operation) {
+            for (size_t alg = 0; alg < AlgCount; ++alg) {
+                for (size_t outcome = 0; outcome < (size_t)Outcome::Count; ++outcome) {
+                    auto histogram = latency((Operation)operation, (Alg)alg, (Outcome)outcome);
+
+                    if (histogram == nullptr) {
+                        continue;
+                    }
+
+                    ostringstream labels{};
+
+                    labels << "operation=\"" << operationName((Operation)operation)
+                        << "\",alg=\"" << algLabel((Alg)alg)
+                        << "\",outcome=\"" << outcomeName((Outcome)outcome) << "\"";
+
+                    // Read the count first so the buckets, which may keep moving, never fall behind it.
+                    auto count = histogram->count();
+
+                    for (auto bound : bucketBounds) {
+                        auto below = histogram->countAtOrBelow((uint64_t)(bound * 1e9));
+
+                        out << "jwt_call_duration_seconds_bucket{" << labels.str() << ",le=\"" << bound << "\"} " << (below < count ? below : count) << "\n";
+                    }
+
+                    out << "jwt_call_duration_seconds_bucket{" << labels.str() << ",le=\"+Inf\"} " << count << "\n";
+                    out << "jwt_call_duration_seconds_sum{" << labels.str() << "} ";
+                    putSeconds(out, histogram->sum());
+                    out << "\n";
+                    out << "jwt_call_duration_seconds_count{" << labels.str() << "} " << count << "\n";
+                }
+            }
+        }
+
+        out << "# HELP jwt_stage_seconds_total Time spent in each stage of jwt calls.\n";
+        out << "# TYPE jwt_stage_seconds_total counter\n";
+
+        for (size_t operation = 0; operation < OperationCount; ++operation) {
+            for (size_t alg = 0; alg < AlgCount; ++alg) {
+                for (size_t stage = 0; stage < StageCount; ++stage) {
+                    auto ticks = m_stageTicks[(operation * AlgCount + alg) * StageCount + stage].load(memory_order_relaxed);
+
+                    if (ticks == 0) {
+                        continue;
+                    }
+
+                    out << "jwt_stage_seconds_total{operation=\"" << operationName((Operation)operation)
+                        << "\",alg=\"" << algLabel((Alg)alg)
+                        << "\",stage=\"" << stageName((Stage)stage) << "\"} ";
+                    putSeconds(out, (uint64_t)(ticks / m_ticksPerNanosecond));
+                    out << "\n";
+                }
+            }
+        }
+
+        out << "# HELP jwt_header_cache_lookups_total Header cache lookups by result.\n";
+        out << "# TYPE jwt_header_cache_lookups_total counter\n";
+        out << "jwt_header_cache_lookups_total{result=\"hit\"} " << cacheHits() << "\n";
+        out << "jwt_header_cache_lookups_total{result=\"miss\"} " << cacheMisses() << "\n";
+
+        out << "# HELP jwt_expired_total Expired tokens reported by the application.\n";
+        out << "# TYPE jwt_expired_total counter\n";
+
+        for (size_t alg = 0; alg < AlgCount; ++alg) {
+            if (auto count = expired((Alg)alg)) {
+                out << "jwt_expired_total{alg=\"" << algLabel((Alg)alg) << "\"} " << count << "\n";
+            }
+        }
+
+        auto violations = limitViolations();
+
+        out << "# HELP jwt_limit_violations_total Tokens rejected for exceeding a parsing limit.\n";
+        out << "# TYPE jwt_limit_violations_total counter\n";
+        out << "jwt_limit_violations_total{limit=\"token_size\"} " << violations.tokenSize << "\n";
+        out << "jwt_limit_violations_total{limit=\"header_size\"} " << violations.headerSize << "\n";
+        out << "jwt_limit_violations_total{limit=\"payload_size\"} " << violations.payloadSize << "\n";
+        out << "jwt_limit_violations_total{limit=\"depth\"} " << violations.depth << "\n";
+        out << "jwt_limit_violations_total{limit=\"claims\"} " << violations.claims << "\n";
+
+        return out.str();
+    }
+}
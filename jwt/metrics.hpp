@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "jwt.hpp"
+#include "instrument.hpp"
+
+namespace jwt {
+    // A latency histogram in the style of HdrHistogram: each power of two is split into 32 linear
+    // sub-buckets, so any recorded value is known to within about 3%, from 1ns up to about 68s. Values
+    // past that land in the last bucket. Recording is a couple of relaxed atomic adds, so any number
+    // of threads can record at once.
+    class LatencyHistogram {
+    public:
+        static constexpr size_t SubBucketBits = 5;
+        static constexpr size_t MaxBits = 36;
+        static constexpr size_t BucketCount = (MaxBits - SubBucketBits + 1) << SubBucketBits;
+
+        void record(uint64_t nanoseconds);
+
+        uint64_t count() const {
+            return m_count.load(std::memory_order_relaxed);
+        }
+
+        uint64_t sum() const {
+            return m_sum.load(std::memory_order_relaxed);
+        }
+
+        // The smallest value at least a fraction p (0 to 1) of the recorded values are at or below,
+        // rounded up to the top of its bucket. Returns 0 if nothing was recorded.
+        uint64_t percentile(double p) const;
+
+        // How many recorded values are at or below the value, to bucket precision.
+        uint64_t countAtOrBelow(uint64_t nanoseconds) const;
+
+        static size_t bucketFor(uint64_t nanoseconds);
+
+        // The largest value that lands in the bucket.
+        static uint64_t bucketTop(size_t bucket);
+
+    private:
+        std::atomic<uint64_t> m_buckets[BucketCount]{};
+        std::atomic<uint64_t> m_count{ 0 };
+        std::atomic<uint64_t> m_sum{ 0 };
+    };
+
+    // Counts and times every encode, decode and verify call by operation, alg and outcome, along with
+    // time per stage and header cache hits and misses, and exports it all as Prometheus text. Install
+    // it with setInstrumentationSink(&registry). It sees nothing if the library was built without
+    // JWT_INSTRUMENTATION. Lock free, histograms are allocated the first time their series is seen.
+    class MetricsRegistry : public InstrumentationSink {
+    public:
+        MetricsRegistry();
+        ~MetricsRegistry() override;
+
+        MetricsRegistry(const MetricsRegistry&) = delete;
+        MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+
+        void record(const CallRecord& call) override;
+
+        // The library doesn't look at exp, so callers that check it themselves report expired tokens
+        // here to have them exported alongside everything else.
+        void recordExpired(Alg alg);
+
+        uint64_t calls(Operation operation, Alg alg, Outcome outcome) const;
+
+        // Returns nullptr if there haven't been any such calls.
+        const LatencyHistogram* latency(Operation operation, Alg alg, Outcome outcome) const;
+
+        uint64_t cacheHits() const {
+            return m_cacheHits.load(std::memory_order_relaxed);
+        }
+
+        uint64_t cacheMisses() const {
+            return m_cacheMisses.load(std::memory_order_relaxed);
+        }
+
+        uint64_t expired(Alg alg) const {
+            return m_expired[(size_t)alg].load(std::memory_order_relaxed);
+        }
+
+        // The Prometheus text exposition (version 0.0.4) of everything recorded so far:
+        //
+        //     jwt_call_duration_seconds{operation,alg,outcome}  histogram
+        //     jwt_stage_seconds_total{operation,alg,stage}       counter
+        //     jwt_header_cache_lookups_total{result}             counter
+        //     jwt_expired_total{alg}                             counter
+        //     jwt_limit_violations_total{limit}                  counter
+        //
+        // Only series that have been seen are written.
+        std::string prometheusText() const;
+
+    private:
+        static constexpr size_t AlgCount = (size_t)Alg::ES512 + 1;
+        static constexpr size_t OperationCount = (size_t)Operation::Verify + 1;
+        static constexpr size_t SeriesCount = OperationCount * AlgCount * (size_t)Outcome::Count;
+        static constexpr size_t StageCount = (size_t)Stage::Count;
+
+        static size_t series(Operation operation, Alg alg, Outcome outcome) {
+            return ((size_t)operation * AlgCount + (size_t)alg) * (size_t)Outcome::Count + (size_t)outcome;
+        }
+
+        double m_ticksPerNanosecond;
+        std::atomic<LatencyHistogram*> m_latency[SeriesCount]{};
+        std::atomic<uint64_t> m_stageTicks[OperationCount * AlgCount * StageCount]{};
+        std::atomic<uint64_t> m_expired[AlgCount]{};
+        std::atomic<uint64_t> m_cacheHits{ 0 };
+        std::atomic<uint64_t> m_cacheMisses{ 0 };
+    };
+}
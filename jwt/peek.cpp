@@ -0,0 +1,393 @@
+#include <cstring>
+
+#include "jwt.hpp"
+#include "peek.hpp"
+
+using namespace std;
+
+namespace jwt {
+    namespace detail {
+        // Just enough of a json lexer to pull a few top level string members out of an object
+        // while it's being decoded. Everything else is skipped, nothing is allocated.
+        template <typename It>
+        class PeekLexer {
+        public:
+            PeekLexer(It begin, It end) : m_it(begin), m_end(end) {
+                advance();
+            }
+
+            // Copies the string members named in names into storage and points views at them. The
+            // whole object is read, and a name that appears twice is an error: nlohmann keeps the last
+            // one where this would see the first, and decode must never act on a different alg.
+            bool members(const char* const* names, StringView* views, size_t count, char* storage, size_t capacity) {
+                size_t used = 0;
+                uint32_t seen = 0;
+
+                if (count > 32) {
+                    return false;
+                }
+
+                ws();
+
+                if (m_c != '{') {
+                    return false;
+                }
+
+                advance();
+                ws();
+
+                if (m_c == '}') {
+                    return true;
+                }
+
+                for (;;) {
+                    char key[maxPeekNameSize];
+                    size_t keyLen = 0;
+
+                    if (m_c != '"' || !string(key, sizeof(key), keyLen)) {
+                        return false;
+                    }
+
+                    ws();
+
+                    if (m_c != ':') {
+                        return false;
+                    }
+
+                    advance();
+                    ws();
+
+                    auto match = count;
+
+                    for (size_t i = 0; i < count && keyLen <= sizeof(key); ++i) {
+                        if (strlen(names[i]) == keyLen && memcmp(names[i], key, keyLen) == 0) {
+                            match = i;
+                            break;
+                        }
+                    }
+
+                    if (match != count) {
+                        if (seen & (1u << match)) {
+                            return false;
+                        }
+
+                        seen |= 1u << match;
+                    }
+
+                    if (match != count && m_c == '"') {
+                        size_t len = 0;
+
+                        // Values that don't fit are an error rather than being truncated.
+                        if (!string(storage + used, capacity - used, len)) {
+                            return false;
+                        }
+
+                        if (len > capacity - used) {
+                            m_truncated = true;
+                            return false;
+                        }
+
+                        views[match] = StringView{ storage + used, len };
+                        used += len;
+                    }
+                    else if (!skip()) {
+                        return false;
+                    }
+
+                    ws();
+
+                    if (m_c == ',') {
+                        advance();
+                        ws();
+                    }
+                    else if (m_c == '}') {
+                        return true;
+                    }
+                    else {
+                        return false;
+                    }
+                }
+            }
+
+            bool truncated() const {
+                return m_truncated;
+            }
+
+        private:
+            void advance() {
+                if (m_it == m_end) {
+                    m_c = '\0';
+                    m_eof = true;
+                    return;
+                }
+
+                m_c = *m_it;
+                ++m_it;
+            }
+
+            void ws() {
+                while (!m_eof && (m_c == ' ' || m_c == '\t' || m_c == '\n' || m_c == '\r')) {
+                    advance();
+                }
+            }
+
+            int hex() {
+                int value = 0;
+
+                for (int i = 0; i < 4; ++i) {
+                    advance();
+
+                    value <<= 4;
+
+                    if (m_c >= '0' && m_c <= '9') {
+                        value |= m_c - '0';
+                    }
+                    else if (m_c >= 'a' && m_c <= 'f') {
+                        value |= m_c - 'a' + 10;
+                    }
+                    else if (m_c >= 'A' && m_c <= 'F') {
+                        value |= m_c - 'A' + 10;
+                    }
+                    else {
+                        return -1;
+                    }
+                }
+
+                return value;
+            }
+
+            // Reads a string, unescaping it into dst. len counts every byte even past capacity so the
+            // caller can tell it was truncated.
+            bool string(char* dst, size_t capacity, size_t& len) {
+                auto put = [&](char c) {
+                    if (len < capacity) {
+                        dst[len] = c;
+                    }
+
+                    ++len;
+                };
+
+                len = 0;
+                advance();
+
+                for (;;) {
+                    if (m_eof || (uint8_t)m_c < 0x20) {
+                        return false;
+                    }
+
+                    if (m_c == '"') {
+                        advance();
+                        return true;
+                    }
+
+                    if (m_c != '\\') {
+                        put(m_c);
+                        advance();
+                        continue;
+                    }
+
+                    advance();
+
+                    switch (m_c) {
+                    case '"':
+                    case '\\':
+                    case '/':
+                        put(m_c);
+                        break;
+
+                    case 'b':
+                        put('\b');
+                        break;
+
+                    case 'f':
+                        put('\f');
+                        break;
+
+                    case 'n':
+                        put('\n');
+                        break;
+
+                    case 'r':
+                        put('\r');
+                        break;
+
+                    case 't':
+                        put('\t');
+                        break;
+
+                    case 'u': {
+                        long cp = hex();
+
+                        if (cp < 0) {
+                            return false;
+                        }
+
+                        if (cp >= 0xD800 && cp <= 0xDBFF) {
+                            advance();
+
+                            if (m_c != '\\') {
+                                return false;
+                            }
+
+                            advance();
+
+                            if (m_c != 'u') {
+                                return false;
+                            }
+
+                            auto low = hex();
+
+                            if (low < 0xDC00 || low > 0xDFFF) {
+                                return false;
+                            }
+
+                            cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                        }
+
+                        if (cp < 0x80) {
+                            put((char)cp);
+                        }
+                        else if (cp < 0x800) {
+                            put((char)(0xC0 | (cp >> 6)));
+                            put((char)(0x80 | (cp & 0x3F)));
+                        }
+                        else if (cp < 0x10000) {
+                            put((char)(0xE0 | (cp >> 12)));
+                            put((char)(0x80 | ((cp >> 6) & 0x3F)));
+                            put((char)(0x80 | (cp & 0x3F)));
+                        }
+                        else {
+                            put((char)(0xF0 | (cp >> 18)));
+                            put((char)(0x80 | ((cp >> 12) & 0x3F)));
+                            put((char)(0x80 | ((cp >> 6) & 0x3F)));
+                            put((char)(0x80 | (cp & 0x3F)));
+                        }
+
+                        break;
+                    }
+
+                    default:
+                        return false;
+                    }
+
+                    advance();
+                }
+            }
+
+            bool skip() {
+                size_t len = 0;
+
+                if (m_c == '"') {
+                    return string(nullptr, 0, len);
+                }
+
+                if (m_c == '{' || m_c == '[') {
+                    size_t depth = 0;
+
+                    do {
+                        if (m_eof) {
+                            return false;
+                        }
+
+                        if (m_c == '"') {
+                            if (!string(nullptr, 0, len)) {
+                                return false;
+                            }
+
+                            continue;
+                        }
+
+                        if (m_c == '{' || m_c == '[') {
+                            ++depth;
+                        }
+                        else if (m_c == '}' || m_c == ']') {
+                            --depth;
+                        }
+
+                        advance();
+                    } while (depth != 0);
+
+                    return true;
+                }
+
+                while (!m_eof && m_c != ',' && m_c != '}' && m_c != ']' && m_c != ' ' && m_c != '\t' && m_c != '\n' && m_c != '\r') {
+                    advance();
+                    ++len;
+                }
+
+                return len != 0;
+            }
+
+            It m_it;
+            It m_end;
+            char m_c{ '\0' };
+            bool m_eof{ false };
+            bool m_truncated{ false };
+        };
+
+        template <typename It>
+        bool peekMembers(It begin, It end, const char* const* names, StringView* views, size_t count, char* storage, size_t capacity, bool* truncated) {
+            PeekLexer<It> lexer{ begin, end };
+
+            if (lexer.members(names, views, count, storage, capacity)) {
+                return true;
+            }
+
+            if (truncated != nullptr) {
+                *truncated = lexer.truncated();
+            }
+
+            return false;
+        }
+
+        bool peekSegment(const char* begin, const char* end, size_t maxSize, const char* const* names, StringView* views, size_t count, char* storage, size_t capacity, bool* truncated) {
+            if ((size_t)(end - begin) * 3 / 4 > maxSize || !Base64UrlIterator::valid(begin, end)) {
+                return false;
+            }
+
+            return peekMembers(Base64UrlIterator{ begin, end }, Base64UrlIterator{ end, end }, names, views, count, storage, capacity, truncated);
+        }
+    }
+
+    bool peekHeader(const string& jwt, PeekedHeader& header, size_t maxHeaderSize) {
+        static const char* const names[] = { "alg", "kid", "typ" };
+        StringView views[3]{};
+
+        auto firstPeriod = jwt.find('.');
+
+        if (firstPeriod == string::npos || jwt.find('.', firstPeriod + 1) == string::npos) {
+            return false;
+        }
+
+        if (!detail::peekSegment(jwt.data(), jwt.data() + firstPeriod, maxHeaderSize, names, views, 3, header.storage, sizeof(header.storage))) {
+            return false;
+        }
+
+        header.alg = views[0];
+        header.kid = views[1];
+        header.typ = views[2];
+
+        return true;
+    }
+
+    bool peekClaim(const string& jwt, const char* name, PeekedClaim& claim, size_t maxPayloadSize) {
+        auto firstPeriod = jwt.find('.');
+        auto secondPeriod = firstPeriod == string::npos ? string::npos : jwt.find('.', firstPeriod + 1);
+
+        if (secondPeriod == string::npos) {
+            return false;
+        }
+
+        claim.value = StringView{};
+
+        if (strlen(name) > detail::maxPeekNameSize) {
+            return false;
+        }
+
+        if (!detail::peekSegment(jwt.data() + firstPeriod + 1, jwt.data() + secondPeriod, maxPayloadSize, &name, &claim.value, 1, claim.storage, sizeof(claim.storage))) {
+            return false;
+        }
+
+        return claim.value.data() == claim.storage;
+    }
+}
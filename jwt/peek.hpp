@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstring>
+#include <string>
+
+namespace jwt {
+    // A non-owning view of a string.
+    class StringView {
+    public:
+        StringView() = default;
+        StringView(const char* data, size_t size) : m_data{ data }, m_size{ size } {}
+
+        const char* data() const {
+            return m_data;
+        }
+
+        size_t size() const {
+            return m_size;
+        }
+
+        bool empty() const {
+            return m_size == 0;
+        }
+
+        std::string str() const {
+            return std::string{ m_data, m_size };
+        }
+
+        bool operator==(const char* other) const {
+            return strlen(other) == m_size && memcmp(m_data, other, m_size) == 0;
+        }
+
+        bool operator!=(const char* other) const {
+            return !(*this == other);
+        }
+
+    private:
+        const char* m_data{ "" };
+        size_t m_size{ 0 };
+    };
+
+    // The routing fields of a jwt's header. The views point into storage, so together they hold at
+    // most 256 bytes.
+    struct PeekedHeader {
+        PeekedHeader() = default;
+        PeekedHeader(const PeekedHeader&) = delete;
+        PeekedHeader& operator=(const PeekedHeader&) = delete;
+
+        StringView alg{};
+        StringView kid{};
+        StringView typ{};
+        char storage[256];
+    };
+
+    // A single string claim of a jwt's payload. The view points into storage, so it holds at most
+    // 256 bytes.
+    struct PeekedClaim {
+        PeekedClaim() = default;
+        PeekedClaim(const PeekedClaim&) = delete;
+        PeekedClaim& operator=(const PeekedClaim&) = delete;
+
+        StringView value{};
+        char storage[256];
+    };
+
+    // Reads alg, kid and typ from the header of the jwt without verifying it or touching the heap.
+    // Headers that would decode to more than maxHeaderSize bytes are rejected before decoding, and
+    // headers with any of the three members twice are rejected outright.
+    // Returns false on failure or if the members don't fit in storage. Missing or non-string
+    // members are left empty.
+    bool peekHeader(const std::string& jwt, PeekedHeader& header, size_t maxHeaderSize = 1024);
+
+    // Reads a top level string claim such as iss from the payload of the jwt without verifying it
+    // or touching the heap. Payloads that would decode to more than maxPayloadSize bytes are
+    // rejected before decoding, and payloads with the claim twice are rejected outright.
+    // Names longer than detail::maxPeekNameSize bytes are never found. Returns false on failure, if
+    // the claim isn't a string or if it doesn't fit in storage.
+    bool peekClaim(const std::string& jwt, const char* name, PeekedClaim& claim, size_t maxPayloadSize = 65536);
+
+    namespace detail {
+        // The longest member name peekSegment can match, as keys are unescaped onto the stack.
+        constexpr size_t maxPeekNameSize = 32;
+
+        // Copies the top level string members named in names out of the base64url encoded object
+        // between begin and end into storage and points views at them. At most 32 names, each of at
+        // most maxPeekNameSize bytes, can be asked for. Returns false on failure or if any of them appears twice. If truncated is given
+        // it's set when the failure was a value that didn't fit in storage.
+        bool peekSegment(const char* begin, const char* end, size_t maxSize, const char* const* names, StringView* views, size_t count, char* storage, size_t capacity, bool* truncated = nullptr);
+    }
+}
@@ -0,0 +1,538 @@
+#include <cctype>
+
+#include "policy.hpp"
+
+using namespace std;
+using namespace nlohmann;
+
+namespace jwt {
+    constexpr size_t Policy::MaxClaims;
+    constexpr size_t Policy::MaxDepth;
+    constexpr size_t Policy::MaxConstants;
+    constexpr size_t Policy::MaxParams;
+
+    namespace detail {
+        enum class PolicyToken {
+            End,
+            Name,
+            Param,
+            Literal,
+            Op,
+            And,
+            Or,
+            Not,
+            Open,
+            Close,
+            // A character no token starts with. Nothing accepts it, so it always fails the rule.
+            Error
+        };
+
+        // Recursive descent compiler from the rule text to postfix bytecode.
+        class PolicyCompiler {
+        public:
+            PolicyCompiler(const string& rule, vector<PolicyInstruction>& code, vector<vector<string>>& claims,
+                vector<json>& constants, vector<string>& params)
+                : m_rule(rule), m_code(code), m_claims(claims), m_constants(constants), m_params(params)
+            {}
+
+            bool compile(string& error) {
+                next();
+
+                // A lexer error ends the rule early, so it must fail it even if what came before parsed.
+                if (!expr() || m_token != PolicyToken::End || !m_error.empty()) {
+                    error = m_error.empty() ? "unexpected '" + m_text + "'" : m_error;
+                    return false;
+                }
+
+                return true;
+            }
+
+        private:
+            bool fail(const string& error) {
+                if (m_error.empty()) {
+                    m_error = error;
+                }
+
+                return false;
+            }
+
+            void next() {
+                while (m_pos < m_rule.length() && isspace((unsigned char)m_rule[m_pos])) {
+                    ++m_pos;
+                }
+
+                m_text.clear();
+
+                if (m_pos >= m_rule.length()) {
+                    m_token = PolicyToken::End;
+                    return;
+                }
+
+                auto isNameChar = [](char c) {
+                    return isalnum((unsigned char)c) || c == '_' || c == '.' || c == '-' || c == ':';
+                };
+                auto start = m_pos;
+                auto c = m_rule[m_pos];
+
+                if (c == '(' || c == ')') {
+                    m_token = c == '(' ? PolicyToken::Open : PolicyToken::Close;
+                    m_text = m_rule.substr(m_pos++, 1);
+                }
+                else if (c == '=' || c == '!' || c == '<' || c == '>') {
+                    ++m_pos;
+
+                    if (m_pos < m_rule.length() && m_rule[m_pos] == '=') {
+                        ++m_pos;
+                    }
+
+                    m_token = PolicyToken::Op;
+                    m_text = m_rule.substr(start, m_pos - start);
+                }
+                else if (c == '"') {
+                    // Let the json parser deal with escapes.
+                    for (++m_pos; m_pos < m_rule.length() && m_rule[m_pos] != '"'; ++m_pos) {
+                        if (m_rule[m_pos] == '\\') {
+                            ++m_pos;
+                        }
+                    }
+
+                    m_token = PolicyToken::Literal;
+                    m_text = m_rule.substr(start, ++m_pos - start);
+                }
+                else if (c == '-' || isdigit((unsigned char)c)) {
+                    for (++m_pos; m_pos < m_rule.length() && (isalnum((unsigned char)m_rule[m_pos]) || m_rule[m_pos] == '.' || m_rule[m_pos] == '-' || m_rule[m_pos] == '+'); ++m_pos) {
+                    }
+
+                    m_token = PolicyToken::Literal;
+                    m_text = m_rule.substr(start, m_pos - start);
+                }
+                else if (c == '$') {
+                    for (++m_pos; m_pos < m_rule.length() && isNameChar(m_rule[m_pos]); ++m_pos) {
+                    }
+
+                    m_token = PolicyToken::Param;
+                    m_text = m_rule.substr(start + 1, m_pos - start - 1);
+                }
+                else if (isNameChar(c)) {
+                    for (++m_pos; m_pos < m_rule.length() && isNameChar(m_rule[m_pos]); ++m_pos) {
+                    }
+
+                    m_text = m_rule.substr(start, m_pos - start);
+
+                    if (m_text == "and") {
+                        m_token = PolicyToken::And;
+                    }
+                    else if (m_text == "or") {
+                        m_token = PolicyToken::Or;
+                    }
+                    else if (m_text == "not") {
+                        m_token = PolicyToken::Not;
+                    }
+                    else if (m_text == "contains" || m_text == "has") {
+                        m_token = PolicyToken::Op;
+                    }
+                    else if (m_text == "true" || m_text == "false" || m_text == "null") {
+                        m_token = PolicyToken::Literal;
+                    }
+                    else {
+                        m_token = PolicyToken::Name;
+                    }
+                }
+                else {
+                    m_token = PolicyToken::Error;
+                    m_text = m_rule.substr(m_pos++, 1);
+                    fail("unexpected '" + m_text + "'");
+                }
+            }
+
+            void emit(PolicyOp op, uint16_t claim = 0, uint16_t index = 0, bool param = false) {
+                if (op == PolicyOp::And || op == PolicyOp::Or) {
+                    --m_depth;
+                }
+                else if (op != PolicyOp::Not) {
+                    ++m_depth;
+                }
+
+                m_code.push_back(PolicyInstruction{ op, param, claim, index });
+            }
+
+            bool expr() {
+                if (!andExpr()) {
+                    return false;
+                }
+
+                while (m_token == PolicyToken::Or) {
+                    next();
+
+                    if (!andExpr()) {
+                        return false;
+                    }
+
+                    emit(PolicyOp::Or);
+                }
+
+                return true;
+            }
+
+            bool andExpr() {
+                if (!unary()) {
+                    return false;
+                }
+
+                while (m_token == PolicyToken::And) {
+                    next();
+
+                    if (!unary()) {
+                        return false;
+                    }
+
+                    emit(PolicyOp::And);
+                }
+
+                return true;
+            }
+
+            bool unary() {
+                if (m_token != PolicyToken::Not && m_token != PolicyToken::Open) {
+                    return comparison();
+                }
+
+                // Rules come from users, so bound the recursion through not and parentheses.
+                if (++m_nesting > Policy::MaxDepth) {
+                    return fail("rule is nested too deeply");
+                }
+
+                if (m_token == PolicyToken::Not) {
+                    next();
+
+                    if (!unary()) {
+                        return false;
+                    }
+
+                    emit(PolicyOp::Not);
+                }
+                else {
+                    next();
+
+                    if (!expr()) {
+                        return false;
+                    }
+
+                    if (m_token != PolicyToken::Close) {
+                        return fail("expected ')'");
+                    }
+
+                    next();
+                }
+
+                --m_nesting;
+                return true;
+            }
+
+            bool comparison() {
+                if (m_token != PolicyToken::Name) {
+                    return fail("expected a claim name");
+                }
+
+                auto claim = intern(m_text);
+
+                if (!m_error.empty()) {
+                    return false;
+                }
+
+                next();
+
+                if (m_token != PolicyToken::Op) {
+                    return fail("expected a comparison after '" + m_claims[claim].front() + "'");
+                }
+
+                PolicyOp op{};
+
+                if (m_text == "==") {
+                    op = PolicyOp::Eq;
+                }
+                else if (m_text == "!=") {
+                    op = PolicyOp::Ne;
+                }
+                else if (m_text == "<") {
+                    op = PolicyOp::Lt;
+                }
+                else if (m_text == "<=") {
+                    op = PolicyOp::Le;
+                }
+                else if (m_text == ">") {
+                    op = PolicyOp::Gt;
+                }
+                else if (m_text == ">=") {
+                    op = PolicyOp::Ge;
+                }
+                else if (m_text == "contains") {
+                    op = PolicyOp::Contains;
+                }
+                else if (m_text == "has") {
+                    op = PolicyOp::Has;
+                }
+                else {
+                    return fail("unknown comparison '" + m_text + "'");
+                }
+
+                auto ordered = op == PolicyOp::Lt || op == PolicyOp::Le || op == PolicyOp::Gt || op == PolicyOp::Ge;
+
+                next();
+
+                if (m_token == PolicyToken::Param) {
+                    if (ordered) {
+                        return fail("parameters can't be compared with '<', '<=', '>' or '>='");
+                    }
+
+                    size_t index = 0;
+
+                    while (index < m_params.size() && m_params[index] != m_text) {
+                        ++index;
+                    }
+
+                    if (index == m_params.size()) {
+                        if (m_params.size() == Policy::MaxParams) {
+                            return fail("too many distinct parameters");
+                        }
+
+                        m_params.push_back(m_text);
+                    }
+
+                    emit(op, claim, (uint16_t)index, true);
+                }
+                else if (m_token == PolicyToken::Literal) {
+                    auto constant = json::parse(m_text, nullptr, false);
+
+                    if (constant.is_discarded()) {
+                        return fail("invalid literal '" + m_text + "'");
+                    }
+
+                    if (ordered && !constant.is_number()) {
+                        return fail("'<', '<=', '>' and '>=' need a number");
+                    }
+
+                    if (m_constants.size() == Policy::MaxConstants) {
+                        return fail("too many literals");
+                    }
+
+                    m_constants.push_back(move(constant));
+                    emit(op, claim, (uint16_t)(m_constants.size() - 1));
+                }
+                else {
+                    return fail("expected a literal or parameter");
+                }
+
+                if (m_depth > Policy::MaxDepth) {
+                    return fail("rule is nested too deeply");
+                }
+
+                next();
+                return true;
+            }
+
+            uint16_t intern(const string& name) {
+                vector<string> path{};
+                size_t start = 0;
+                size_t dot = 0;
+
+                while ((dot = name.find('.', start)) != string::npos) {
+                    path.push_back(name.substr(start, dot - start));
+                    start = dot + 1;
+                }
+
+                path.push_back(name.substr(start));
+
+                for (size_t i = 0; i < m_claims.size(); ++i) {
+                    if (m_claims[i] == path) {
+                        return (uint16_t)i;
+                    }
+                }
+
+                if (m_claims.size() == Policy::MaxClaims) {
+                    fail("too many distinct claims");
+                    return 0;
+                }
+
+                m_claims.push_back(move(path));
+                return (uint16_t)(m_claims.size() - 1);
+            }
+
+            const string& m_rule;
+            vector<PolicyInstruction>& m_code;
+            vector<vector<string>>& m_claims;
+            vector<json>& m_constants;
+            vector<string>& m_params;
+            size_t m_pos{ 0 };
+            size_t m_depth{ 0 };
+            size_t m_nesting{ 0 };
+            PolicyToken m_token{ PolicyToken::End };
+            string m_text{};
+            string m_error{};
+        };
+
+        // Whether word is one of the space separated words in str.
+        bool hasWord(const string& str, const string& word) {
+            size_t pos = 0;
+
+            while ((pos = str.find(word, pos)) != string::npos) {
+                auto end = pos + word.length();
+
+                if ((pos == 0 || str[pos - 1] == ' ') && (end == str.length() || str[end] == ' ')) {
+                    return true;
+                }
+
+                pos = end;
+            }
+
+            return false;
+        }
+
+        bool equals(const json& claim, const json* constant, const string* param) {
+            if (param != nullptr) {
+                return claim.is_string() && claim.get_ref<const string&>() == *param;
+            }
+
+            return claim == *constant;
+        }
+
+        bool test(PolicyOp op, const json* claim, const json* constant, const string* param) {
+            // Missing claims never satisfy a comparison.
+            if (claim == nullptr) {
+                return false;
+            }
+
+            switch (op) {
+            case PolicyOp::Eq:
+                return equals(*claim, constant, param);
+
+            case PolicyOp::Ne:
+                return !equals(*claim, constant, param);
+
+            case PolicyOp::Lt:
+                return claim->is_number() && claim->get<double>() < constant->get<double>();
+
+            case PolicyOp::Le:
+                return claim->is_number() && claim->get<double>() <= constant->get<double>();
+
+            case PolicyOp::Gt:
+                return claim->is_number() && claim->get<double>() > constant->get<double>();
+
+            case PolicyOp::Ge:
+                return claim->is_number() && claim->get<double>() >= constant->get<double>();
+
+            case PolicyOp::Has:
+                if (claim->is_string()) {
+                    if (param != nullptr) {
+                        return hasWord(claim->get_ref<const string&>(), *param);
+                    }
+
+                    return constant->is_string() && hasWord(claim->get_ref<const string&>(), constant->get_ref<const string&>());
+                }
+
+                // Fall through - arrays are checked as contains checks them.
+
+            case PolicyOp::Contains:
+                if (claim->is_array()) {
+                    for (auto& element : *claim) {
+                        if (equals(element, constant, param)) {
+                            return true;
+                        }
+                    }
+
+                    return false;
+                }
+
+                return equals(*claim, constant, param);
+
+            default:
+                return false;
+            }
+        }
+    }
+
+    bool Policy::compile(const string& rule) {
+        m_code.clear();
+        m_claims.clear();
+        m_constants.clear();
+        m_params.clear();
+        m_error.clear();
+
+        detail::PolicyCompiler compiler{ rule, m_code, m_claims, m_constants, m_params };
+
+        if (!compiler.compile(m_error)) {
+            m_code.clear();
+            return false;
+        }
+
+        return true;
+    }
+
+    int Policy::param(const string& name) const {
+        for (size_t i = 0; i < m_params.size(); ++i) {
+            if (m_params[i] == name) {
+                return (int)i;
+            }
+        }
+
+        return -1;
+    }
+
+    bool Policy::evaluate(const json& payload, const vector<string>& params) const {
+        if (m_code.empty() || !payload.is_object() || params.size() < m_params.size()) {
+            return false;
+        }
+
+        // Resolve every claim the rule uses once up front, instructions only refer to slots.
+        const json* slots[MaxClaims];
+
+        for (size_t i = 0; i < m_claims.size(); ++i) {
+            const json* value = &payload;
+
+            for (auto& name : m_claims[i]) {
+                if (value == nullptr || !value->is_object()) {
+                    value = nullptr;
+                    break;
+                }
+
+                auto it = value->find(name);
+                value = it == value->end() ? nullptr : &*it;
+            }
+
+            slots[i] = value;
+        }
+
+        bool stack[MaxDepth];
+        size_t top = 0;
+
+        for (auto& ins : m_code) {
+            switch (ins.op) {
+            case detail::PolicyOp::And:
+                --top;
+                stack[top - 1] = stack[top - 1] && stack[top];
+                break;
+
+            case detail::PolicyOp::Or:
+                --top;
+                stack[top - 1] = stack[top - 1] || stack[top];
+                break;
+
+            case detail::PolicyOp::Not:
+                stack[top - 1] = !stack[top - 1];
+                break;
+
+            default:
+                if (ins.param) {
+                    stack[top++] = detail::test(ins.op, slots[ins.claim], nullptr, &params[ins.index]);
+                }
+                else {
+                    stack[top++] = detail::test(ins.op, slots[ins.claim], &m_constants[ins.index], nullptr);
+                }
+
+                break;
+            }
+        }
+
+        return stack[0];
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "json.hpp"
+
+namespace jwt {
+    namespace detail {
+        enum class PolicyOp : uint8_t {
+            Eq,
+            Ne,
+            Lt,
+            Le,
+            Gt,
+            Ge,
+            Contains,
+            Has,
+            And,
+            Or,
+            Not
+        };
+
+        struct PolicyInstruction {
+            PolicyOp op;
+            bool param;      // Whether index refers to a parameter or a constant.
+            uint16_t claim;  // Interned claim slot for comparisons.
+            uint16_t index;
+        };
+    }
+
+    // An authorization rule over a token's claims, compiled once into bytecode and evaluated
+    // per request. For example:
+    //
+    //     aud contains "api" and (scope has "read" or roles contains "admin") and tenant_id == $tenant
+    //
+    // Comparisons are ==, !=, <, <=, >, >=, contains (array membership, or equality for a plain
+    // string claim such as a single aud) and has (a word of a space separated string such as scope,
+    // or array membership). They combine with and, or, not and parentheses. Claims can name nested
+    // members with dots, and $name operands are strings supplied at evaluation time.
+    class Policy {
+    public:
+        static constexpr size_t MaxClaims = 64;
+        static constexpr size_t MaxDepth = 64;
+
+        // Instructions refer to literals and $name parameters by 16 bit index.
+        static constexpr size_t MaxConstants = 0xffff;
+        static constexpr size_t MaxParams = 0xffff;
+
+        // Returns false and sets error() if the rule can't be compiled.
+        bool compile(const std::string& rule);
+
+        // Returns the index of the named parameter within the params passed to evaluate, or -1 if
+        // the rule doesn't use it.
+        int param(const std::string& name) const;
+
+        // Returns true if the payload satisfies the rule. An uncompiled policy never does.
+        bool evaluate(const nlohmann::json& payload, const std::vector<std::string>& params = {}) const;
+
+        const std::string& error() const {
+            return m_error;
+        }
+
+        explicit operator bool() const {
+            return !m_code.empty();
+        }
+
+    private:
+        std::vector<detail::PolicyInstruction> m_code{};
+        std::vector<std::vector<std::string>> m_claims{};
+        std::vector<nlohmann::json> m_constants{};
+        std::vector<std::string> m_params{};
+        std::string m_error{};
+    };
+}
@@ -0,0 +1,460 @@
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+#include "jwt.hpp"
+#include "projection.hpp"
+
+using namespace std;
+using namespace nlohmann;
+
+namespace jwt {
+    namespace detail {
+        // Guards the recursive scanner against absurdly nested payloads.
+        constexpr size_t maxProjectionDepth = 512;
+
+        // Single pass scanner over a raw json document that records the spans of the values a
+        // projection asks for and validates everything else without parsing it.
+        class ProjectionScanner {
+        public:
+            ProjectionScanner(const string& payload, const Projection& projection, vector<JsonView>& values)
+                : m_pos(payload.c_str()), m_end(payload.c_str() + payload.length()),
+                  m_nodes(projection.nodes()), m_values(values)
+            {}
+
+            bool scan() {
+                // Even with nothing to extract, so an empty projection still rejects malformed payloads.
+                if (!value(0, 0)) {
+                    return false;
+                }
+
+                ws();
+                return m_pos == m_end;
+            }
+
+        private:
+            void ws() {
+                while (m_pos < m_end && (*m_pos == ' ' || *m_pos == '\t' || *m_pos == '\n' || *m_pos == '\r')) {
+                    ++m_pos;
+                }
+            }
+
+            bool value(int node, size_t depth) {
+                if (depth > maxProjectionDepth) {
+                    return false;
+                }
+
+                ws();
+
+                if (m_pos >= m_end) {
+                    return false;
+                }
+
+                auto start = m_pos;
+                auto ok = true;
+
+                switch (*m_pos) {
+                case '{':
+                    ok = object(node, depth);
+                    break;
+
+                case '[':
+                    ok = array(node, depth);
+                    break;
+
+                case '"':
+                    ok = skipString();
+                    break;
+
+                case 't':
+                    ok = literal("true");
+                    break;
+
+                case 'f':
+                    ok = literal("false");
+                    break;
+
+                case 'n':
+                    ok = literal("null");
+                    break;
+
+                default:
+                    ok = number();
+                    break;
+                }
+
+                if (!ok) {
+                    return false;
+                }
+
+                if (node != -1 && m_nodes[node].result != -1) {
+                    m_values[m_nodes[node].result] = JsonView{ start, (size_t)(m_pos - start) };
+                }
+
+                return true;
+            }
+
+            bool skipString() {
+                for (++m_pos; m_pos < m_end; ++m_pos) {
+                    if ((uint8_t)*m_pos < 0x20) {
+                        return false;
+                    }
+
+                    if (*m_pos == '"') {
+                        ++m_pos;
+                        return true;
+                    }
+
+                    if (*m_pos != '\\') {
+                        continue;
+                    }
+
+                    if (++m_pos == m_end || strchr("\"\\/bfnrtu", *m_pos) == nullptr) {
+                        return false;
+                    }
+
+                    if (*m_pos == 'u') {
+                        for (int i = 0; i < 4; ++i) {
+                            if (++m_pos == m_end || !isxdigit((unsigned char)*m_pos)) {
+                                return false;
+                            }
+                        }
+                    }
+                }
+
+                return false;
+            }
+
+            bool literal(const char* word) {
+                auto len = strlen(word);
+
+                if ((size_t)(m_end - m_pos) < len || memcmp(m_pos, word, len) != 0) {
+                    return false;
+                }
+
+                m_pos += len;
+                return true;
+            }
+
+            bool digits() {
+                auto start = m_pos;
+
+                while (m_pos < m_end && *m_pos >= '0' && *m_pos <= '9') {
+                    ++m_pos;
+                }
+
+                return m_pos != start;
+            }
+
+            // -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+            bool number() {
+                if (m_pos < m_end && *m_pos == '-') {
+                    ++m_pos;
+                }
+
+                if (m_pos < m_end && *m_pos == '0') {
+                    ++m_pos;
+                }
+                else if (!digits()) {
+                    return false;
+                }
+
+                if (m_pos < m_end && *m_pos == '.') {
+                    ++m_pos;
+
+                    if (!digits()) {
+                        return false;
+                    }
+                }
+
+                if (m_pos < m_end && (*m_pos == 'e' || *m_pos == 'E')) {
+                    ++m_pos;
+
+                    if (m_pos < m_end && (*m_pos == '+' || *m_pos == '-')) {
+                        ++m_pos;
+                    }
+
+                    if (!digits()) {
+                        return false;
+                    }
+                }
+
+                return true;
+            }
+
+            // A key seen again replaces everything found under it before, as it does in nlohmann.
+            void forget(int node) {
+                if (m_nodes[node].result != -1) {
+                    m_values[m_nodes[node].result] = JsonView{};
+                }
+
+                for (auto& edge : m_nodes[node].edges) {
+                    forget(edge.node);
+                }
+            }
+
+            int child(int node, const char* key, size_t len) const {
+                if (node == -1) {
+                    return -1;
+                }
+
+                auto escaped = memchr(key, '\\', len) != nullptr;
+
+                for (auto& edge : m_nodes[node].edges) {
+                    if (escaped) {
+                        if (JsonView{ key - 1, len + 2 }.str() == edge.key) {
+                            return edge.node;
+                        }
+                    }
+                    else if (edge.key.length() == len && memcmp(edge.key.c_str(), key, len) == 0) {
+                        return edge.node;
+                    }
+                }
+
+                return -1;
+            }
+
+            int child(int node, long index) const {
+                if (node == -1) {
+                    return -1;
+                }
+
+                for (auto& edge : m_nodes[node].edges) {
+                    if (edge.index == index) {
+                        return edge.node;
+                    }
+                }
+
+                return -1;
+            }
+
+            bool object(int node, size_t depth) {
+                ++m_pos;
+                ws();
+
+                if (m_pos < m_end && *m_pos == '}') {
+                    ++m_pos;
+                    return true;
+                }
+
+                while (m_pos < m_end) {
+                    if (*m_pos != '"') {
+                        return false;
+                    }
+
+                    auto key = m_pos + 1;
+
+                    if (!skipString()) {
+                        return false;
+                    }
+
+                    auto next = child(node, key, m_pos - key - 1);
+
+                    if (next != -1) {
+                        forget(next);
+                    }
+
+                    ws();
+
+                    if (m_pos >= m_end || *m_pos != ':') {
+                        return false;
+                    }
+
+                    ++m_pos;
+
+                    if (!value(next, depth + 1)) {
+                        return false;
+                    }
+
+                    ws();
+
+                    if (m_pos < m_end && *m_pos == ',') {
+                        ++m_pos;
+                        ws();
+                    }
+                    else if (m_pos < m_end && *m_pos == '}') {
+                        ++m_pos;
+                        return true;
+                    }
+                    else {
+                        return false;
+                    }
+                }
+
+                return false;
+            }
+
+            bool array(int node, size_t depth) {
+                ++m_pos;
+                ws();
+
+                if (m_pos < m_end && *m_pos == ']') {
+                    ++m_pos;
+                    return true;
+                }
+
+                for (long index = 0; m_pos < m_end; ++index) {
+                    if (!value(child(node, index), depth + 1)) {
+                        return false;
+                    }
+
+                    ws();
+
+                    if (m_pos < m_end && *m_pos == ',') {
+                        ++m_pos;
+                    }
+                    else if (m_pos < m_end && *m_pos == ']') {
+                        ++m_pos;
+                        return true;
+                    }
+                    else {
+                        return false;
+                    }
+                }
+
+                return false;
+            }
+
+            const char* m_pos;
+            const char* m_end;
+            const vector<ProjectionNode>& m_nodes;
+            vector<JsonView>& m_values;
+        };
+    }
+
+    std::string JsonView::str() const {
+        if (!isString()) {
+            return std::string{};
+        }
+
+        // Only bother the json parser when there are escapes to deal with.
+        if (memchr(m_data, '\\', m_size) == nullptr) {
+            return std::string{ m_data + 1, m_size - 2 };
+        }
+
+        auto value = nlohmann::json::parse(m_data, m_data + m_size, nullptr, false);
+
+        return value.is_string() ? value.get<std::string>() : std::string{};
+    }
+
+    int64_t JsonView::integer() const {
+        if (!isNumber()) {
+            return 0;
+        }
+
+        // The view isn't NUL terminated, numbers are short enough to copy.
+        return strtoll(std::string{ m_data, m_size }.c_str(), nullptr, 10);
+    }
+
+    double JsonView::number() const {
+        if (!isNumber()) {
+            return 0.0;
+        }
+
+        return strtod(std::string{ m_data, m_size }.c_str(), nullptr);
+    }
+
+    nlohmann::json JsonView::json() const {
+        if (empty()) {
+            return nlohmann::json{};
+        }
+
+        auto value = nlohmann::json::parse(m_data, m_data + m_size, nullptr, false);
+
+        return value.is_discarded() ? nlohmann::json{} : value;
+    }
+
+    Projection::Projection()
+        : m_nodes(1)
+    {}
+
+    Projection::Projection(initializer_list<std::string> pointers)
+        : Projection()
+    {
+        for (auto& pointer : pointers) {
+            add(pointer);
+        }
+    }
+
+    int Projection::add(const std::string& pointer) {
+        if (!pointer.empty() && pointer[0] != '/') {
+            return -1;
+        }
+
+        int node = 0;
+        size_t pos = 0;
+
+        while (pos < pointer.length()) {
+            auto end = pointer.find('/', pos + 1);
+
+            if (end == std::string::npos) {
+                end = pointer.length();
+            }
+
+            // Unescape the reference token, ~1 is / and ~0 is ~.
+            std::string key{};
+
+            for (auto i = pos + 1; i < end; ++i) {
+                if (pointer[i] != '~') {
+                    key += pointer[i];
+                }
+                else if (i + 1 < end && (pointer[i + 1] == '0' || pointer[i + 1] == '1')) {
+                    key += pointer[++i] == '0' ? '~' : '/';
+                }
+                else {
+                    return -1;
+                }
+            }
+
+            int next = -1;
+
+            for (auto& edge : m_nodes[node].edges) {
+                if (edge.key == key) {
+                    next = edge.node;
+                    break;
+                }
+            }
+
+            if (next == -1) {
+                // Array indices are plain decimal numbers without leading zeros.
+                long index = -1;
+
+                if (!key.empty() && key.length() < 10 && key.find_first_not_of("0123456789") == std::string::npos && (key[0] != '0' || key.length() == 1)) {
+                    index = strtol(key.c_str(), nullptr, 10);
+                }
+
+                next = (int)m_nodes.size();
+                m_nodes[node].edges.push_back(detail::ProjectionEdge{ key, index, next });
+                m_nodes.emplace_back();
+            }
+
+            node = next;
+            pos = end;
+        }
+
+        if (m_nodes[node].result == -1) {
+            m_nodes[node].result = (int)m_size++;
+        }
+
+        return m_nodes[node].result;
+    }
+
+    bool ProjectedClaims::scan(const Projection& projection, std::string payload) {
+        m_payload = move(payload);
+        m_values.assign(projection.size(), JsonView{});
+
+        detail::ProjectionScanner scanner{ m_payload, projection, m_values };
+
+        return scanner.scan();
+    }
+
+    bool decode(const std::string& jwt, const std::string& key, const Projection& projection, ProjectedClaims& claims, const set<std::string>& alg) {
+        std::string payload{};
+
+        if (!detail::decodePayload(jwt, key, alg, payload)) {
+            return false;
+        }
+
+        return claims.scan(projection, move(payload));
+    }
+}
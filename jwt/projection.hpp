@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstdint>
+#include <initializer_list>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "json.hpp"
+
+namespace jwt {
+    // A view of a single raw json value inside a decoded payload.
+    class JsonView {
+    public:
+        JsonView() = default;
+        JsonView(const char* data, size_t size) : m_data{ data }, m_size{ size } {}
+
+        const char* data() const {
+            return m_data;
+        }
+
+        size_t size() const {
+            return m_size;
+        }
+
+        // Empty if the value wasn't found.
+        bool empty() const {
+            return m_size == 0;
+        }
+
+        bool isString() const {
+            return !empty() && *m_data == '"';
+        }
+
+        bool isObject() const {
+            return !empty() && *m_data == '{';
+        }
+
+        bool isArray() const {
+            return !empty() && *m_data == '[';
+        }
+
+        bool isNull() const {
+            return !empty() && *m_data == 'n';
+        }
+
+        bool isBool() const {
+            return !empty() && (*m_data == 't' || *m_data == 'f');
+        }
+
+        bool isNumber() const {
+            return !empty() && (*m_data == '-' || (*m_data >= '0' && *m_data <= '9'));
+        }
+
+        // The value exactly as it appears in the payload.
+        std::string raw() const {
+            return std::string{ m_data, m_size };
+        }
+
+        // The unescaped contents of a string value, or an empty string for other values.
+        std::string str() const;
+
+        // The value of a number, or 0 for other values.
+        int64_t integer() const;
+        double number() const;
+
+        bool boolean() const {
+            return !empty() && *m_data == 't';
+        }
+
+        // Parses the value, returning a null json object if it's empty or isn't json.
+        nlohmann::json json() const;
+
+    private:
+        const char* m_data{ nullptr };
+        size_t m_size{ 0 };
+    };
+
+    namespace detail {
+        struct ProjectionEdge {
+            std::string key;
+            long index;  // The key as an array index, or -1.
+            int node;
+        };
+
+        struct ProjectionNode {
+            std::vector<ProjectionEdge> edges{};
+            int result{ -1 };
+        };
+    }
+
+    // A set of json pointers (RFC 6901) to extract from payloads, e.g. "/sub", "/exp" and
+    // "/tenant/id". The payload is scanned once and values that weren't asked for are validated
+    // and skipped without being parsed. A key that appears more than once resolves to its last
+    // value, as it does when the payload is decoded.
+    class Projection {
+    public:
+        Projection();
+        Projection(std::initializer_list<std::string> pointers);
+
+        // Returns the index of the pointer's value in the results, or -1 if the pointer is invalid.
+        int add(const std::string& pointer);
+
+        size_t size() const {
+            return m_size;
+        }
+
+        const std::vector<detail::ProjectionNode>& nodes() const {
+            return m_nodes;
+        }
+
+    private:
+        std::vector<detail::ProjectionNode> m_nodes{};
+        size_t m_size{ 0 };
+    };
+
+    // The values extracted by a projection. Views point into the decoded payload owned by this.
+    class ProjectedClaims {
+    public:
+        ProjectedClaims() = default;
+        ProjectedClaims(const ProjectedClaims&) = delete;
+        ProjectedClaims& operator=(const ProjectedClaims&) = delete;
+
+        // Views in the order the pointers were added to the projection, empty if not found.
+        const JsonView& operator[](size_t index) const {
+            return m_values[index];
+        }
+
+        size_t size() const {
+            return m_values.size();
+        }
+
+        // Scans payload for the projection's values, taking ownership of it.
+        // Returns false if the payload is malformed.
+        bool scan(const Projection& projection, std::string payload);
+
+    private:
+        std::string m_payload{};
+        std::vector<JsonView> m_values{};
+    };
+
+    // Verifies the jwt and extracts only the projection's values from its payload.
+    // Returns false on failure.
+    bool decode(const std::string& jwt, const std::string& key, const Projection& projection, ProjectedClaims& claims, const std::set<std::string>& alg = {});
+}
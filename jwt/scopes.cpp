@@ -0,0 +1,148 @@
+#include <cstring>
+
+#include "jwt.hpp"
+#include "scopes.hpp"
+
+using namespace std;
+using namespace nlohmann;
+
+namespace jwt {
+    namespace detail {
+        // Twice the number of possible scopes keeps linear probing short.
+        constexpr size_t scopeTableSize = 512;
+
+        size_t hashScope(const char* scope, size_t len) {
+            return hashBytes(scope, len) & (scopeTableSize - 1);
+        }
+    }
+
+    ScopeVocabulary::ScopeVocabulary(vector<string> claims)
+        : m_claims(move(claims)), m_table(detail::scopeTableSize, -1)
+    {}
+
+    int ScopeVocabulary::add(const string& scope) {
+        auto index = find(scope);
+
+        if (index != -1) {
+            return index;
+        }
+
+        if (m_names.size() == Scopes{}.size()) {
+            return -1;
+        }
+
+        auto slot = detail::hashScope(scope.c_str(), scope.length());
+
+        while (m_table[slot] != -1) {
+            slot = (slot + 1) & (detail::scopeTableSize - 1);
+        }
+
+        m_table[slot] = (int16_t)m_names.size();
+        m_names.push_back(scope);
+
+        return m_table[slot];
+    }
+
+    int ScopeVocabulary::find(const string& scope) const {
+        return find(scope.c_str(), scope.length());
+    }
+
+    int ScopeVocabulary::find(const char* scope, size_t len) const {
+        auto slot = detail::hashScope(scope, len);
+
+        while (m_table[slot] != -1) {
+            auto& name = m_names[m_table[slot]];
+
+            if (name.length() == len && memcmp(name.c_str(), scope, len) == 0) {
+                return m_table[slot];
+            }
+
+            slot = (slot + 1) & (detail::scopeTableSize - 1);
+        }
+
+        return -1;
+    }
+
+    bool ScopeVocabulary::set(initializer_list<string> scopes, Scopes& result) const {
+        result.reset();
+
+        for (auto& scope : scopes) {
+            auto index = find(scope);
+
+            if (index == -1) {
+                result.reset();
+                return false;
+            }
+
+            result.set(index);
+        }
+
+        return true;
+    }
+
+    void ScopeVocabulary::internWords(const string& str, Scopes& scopes) const {
+        auto data = str.c_str();
+        auto end = data + str.length();
+
+        while (data < end) {
+            auto word = data;
+
+            while (data < end && *data != ' ') {
+                ++data;
+            }
+
+            if (data != word) {
+                auto index = find(word, data - word);
+
+                if (index != -1) {
+                    scopes.set(index);
+                }
+            }
+
+            ++data;
+        }
+    }
+
+    Scopes ScopeVocabulary::intern(const json& payload) const {
+        Scopes scopes{};
+
+        if (!payload.is_object()) {
+            return scopes;
+        }
+
+        for (auto& claim : m_claims) {
+            auto it = payload.find(claim);
+
+            if (it == payload.end()) {
+                continue;
+            }
+
+            if (it->is_string()) {
+                internWords(it->get_ref<const string&>(), scopes);
+            }
+            else if (it->is_array()) {
+                for (auto& element : *it) {
+                    if (!element.is_string()) {
+                        continue;
+                    }
+
+                    auto index = find(element.get_ref<const string&>());
+
+                    if (index != -1) {
+                        scopes.set(index);
+                    }
+                }
+            }
+        }
+
+        return scopes;
+    }
+
+    json decode(const string& jwt, const string& key, const ScopeVocabulary& vocabulary, Scopes& scopes, const set<string>& alg) {
+        auto payload = decode(jwt, key, alg);
+
+        scopes = vocabulary.intern(payload);
+
+        return payload;
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <bitset>
+#include <cstdint>
+#include <initializer_list>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "json.hpp"
+
+namespace jwt {
+    // A token's permissions as bits indexed by a ScopeVocabulary.
+    using Scopes = std::bitset<256>;
+
+    // Returns true if every scope in required is also in scopes.
+    inline bool hasAll(const Scopes& scopes, const Scopes& required) {
+        return (scopes & required) == required;
+    }
+
+    // Returns true if any scope in wanted is also in scopes.
+    inline bool hasAny(const Scopes& scopes, const Scopes& wanted) {
+        return (scopes & wanted).any();
+    }
+
+    // Maps a configured set of scope and role names to bit indices so tokens' scope claims can be
+    // turned into a Scopes bitset once and checked with a couple of AND instructions afterwards.
+    // Lookups hash the words in place and don't allocate.
+    class ScopeVocabulary {
+    public:
+        // The claims read by intern. Space separated strings (like scope) and arrays of strings
+        // (like roles) are both understood.
+        explicit ScopeVocabulary(std::vector<std::string> claims = { "scope", "scp", "roles" });
+
+        // Returns the index of the scope, adding it if needed, or -1 if the vocabulary is full.
+        int add(const std::string& scope);
+
+        // Returns the index of the scope or -1 if it isn't in the vocabulary.
+        int find(const std::string& scope) const;
+
+        // Sets result to the given scopes. Returns false if any of them isn't in the vocabulary, so a
+        // misspelled requirement fails rather than quietly checking fewer scopes.
+        bool set(std::initializer_list<std::string> scopes, Scopes& result) const;
+
+        // Returns the known scopes found in the vocabulary's claims. Unknown scopes are ignored.
+        Scopes intern(const nlohmann::json& payload) const;
+
+        size_t size() const {
+            return m_names.size();
+        }
+
+    private:
+        int find(const char* scope, size_t len) const;
+        void internWords(const std::string& str, Scopes& scopes) const;
+
+        std::vector<std::string> m_claims{};
+        std::vector<std::string> m_names{};
+        std::vector<int16_t> m_table{};
+    };
+
+    // Decodes like jwt::decode and also interns the payload's scope claims into scopes.
+    // Returns a null json object on failure.
+    nlohmann::json decode(const std::string& jwt, const std::string& key, const ScopeVocabulary& vocabulary, Scopes& scopes, const std::set<std::string>& alg = {});
+}
@@ -0,0 +1,178 @@
+#include "shadow.hpp"
+
+using namespace std;
+using namespace nlohmann;
+
+namespace jwt {
+    namespace {
+        json fastDecode(const string& jwt, const string& key, const set<string>& alg) {
+            return decode(jwt, key, alg);
+        }
+    }
+
+    namespace detail {
+        json referenceDecode(const string& jwt, const string& key, const set<string>& alg) {
+            auto firstPeriod = jwt.find_first_of('.');
+            auto secondPeriod = jwt.find_first_of('.', firstPeriod + 1);
+
+            if (jwt.empty() || firstPeriod == string::npos || secondPeriod == string::npos) {
+                return json{};
+            }
+
+            // Decode the header so we can get the alg used by the jwt.
+            auto decodedHeader = b64decode(jwt.substr(0, firstPeriod));
+            auto header = json::parse(string{ decodedHeader.begin(), decodedHeader.end() }, nullptr, false);
+
+            if (!header.is_object() || !header["alg"].is_string()) {
+                return json{};
+            }
+
+            const string& theAlg = header["alg"];
+
+            // Make sure no key is supplied if the alg is none.
+            if (theAlg == "none" && !key.empty()) {
+                return json{};
+            }
+            // Make sure the alg supplied is one we expect.
+            else if (alg.count(theAlg) == 0 && !alg.empty()) {
+                return json{};
+            }
+
+            auto encodedToken = jwt.substr(0, secondPeriod);
+            auto signature = jwt.substr(secondPeriod + 1);
+
+            // Verify the signature.
+            if (theAlg == "none") {
+                // Nothing to do, no verification needed.
+            }
+            else if (theAlg.find("HS") != string::npos) {
+                auto calculatedSignature = signHMAC(encodedToken, key, theAlg);
+
+                if (signature != calculatedSignature || calculatedSignature.empty()) {
+                    return json{};
+                }
+            }
+            else if (!verifyPEM(encodedToken, signature, key, theAlg)) {
+                return json{};
+            }
+
+            // Decode the payload since the jwt has been verified.
+            auto decodedPayload = b64decode(jwt.substr(firstPeriod + 1, secondPeriod - firstPeriod - 1));
+            auto payload = json::parse(string{ decodedPayload.begin(), decodedPayload.end() }, nullptr, false);
+
+            return payload.is_discarded() ? json{} : payload;
+        }
+    }
+
+    ShadowVerifier::ShadowVerifier(size_t sampleEvery, Decoder fast, MismatchHandler handler, size_t queueCapacity)
+        : m_sampleEvery{ sampleEvery == 0 ? 1 : sampleEvery },
+        m_fast(fast ? move(fast) : Decoder{ fastDecode }),
+        m_handler(move(handler)),
+        m_queueCapacity{ queueCapacity == 0 ? 1 : queueCapacity },
+        m_thread{ &ShadowVerifier::run, this }
+    {
+    }
+
+    ShadowVerifier::~ShadowVerifier() {
+        {
+            lock_guard<mutex> lock{ m_mutex };
+            m_stop = true;
+        }
+
+        m_wake.notify_one();
+        m_thread.join();
+    }
+
+    json ShadowVerifier::decode(const string& jwt, const string& key, const set<string>& alg) {
+        auto sampled = m_calls.fetch_add(1, memory_order_relaxed) % m_sampleEvery == 0;
+
+        if (!sampled) {
+            return m_fast(jwt, key, alg);
+        }
+
+        json fast{};
+
+        try {
+            fast = m_fast(jwt, key, alg);
+        }
+        catch (...) {
+            // Throwing counts as rejecting the token.
+            sample(jwt, key, alg, json{});
+            throw;
+        }
+
+        sample(jwt, key, alg, fast);
+
+        return fast;
+    }
+
+    void ShadowVerifier::drain() {
+        unique_lock<mutex> lock{ m_mutex };
+
+        m_idle.wait(lock, [this]() { return m_queue.empty() && !m_busy; });
+    }
+
+    void ShadowVerifier::sample(const string& jwt, const string& key, const set<string>& alg, const json& fast) {
+        {
+            lock_guard<mutex> lock{ m_mutex };
+
+            if (m_queue.size() >= m_queueCapacity) {
+                m_dropped.fetch_add(1, memory_order_relaxed);
+                return;
+            }
+
+            m_queue.push_back(Sample{ jwt, key, alg, fast });
+        }
+
+        m_wake.notify_one();
+    }
+
+    void ShadowVerifier::run() {
+        unique_lock<mutex> lock{ m_mutex };
+
+        for (;;) {
+            m_wake.wait(lock, [this]() { return m_stop || !m_queue.empty(); });
+
+            if (m_queue.empty()) {
+                return;
+            }
+
+            auto sample = move(m_queue.front());
+
+            m_queue.pop_front();
+            m_busy = true;
+            lock.unlock();
+
+            auto reference = detail::referenceDecode(sample.jwt, sample.key, sample.alg);
+
+            if (reference != sample.fast) {
+                m_mismatches.fetch_add(1, memory_order_relaxed);
+
+                if (m_handler) {
+                    ShadowMismatch mismatch{};
+
+                    mismatch.fastVerified = !sample.fast.is_null();
+                    mismatch.referenceVerified = !reference.is_null();
+                    mismatch.token = detail::captureToken(sample.jwt, Alg::Unknown, mismatch.fastVerified ? Outcome::Ok : Outcome::Malformed);
+
+                    auto header = json::parse(mismatch.token.header, nullptr, false);
+
+                    if (header.is_object() && header["alg"].is_string()) {
+                        mismatch.token.alg = algFromName(header["alg"].get<string>());
+                    }
+
+                    m_handler(mismatch);
+                }
+            }
+
+            m_checked.fetch_add(1, memory_order_relaxed);
+
+            lock.lock();
+            m_busy = false;
+
+            if (m_queue.empty()) {
+                m_idle.notify_all();
+            }
+        }
+    }
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+#include "jwt.hpp"
+#include "capture.hpp"
+#include "json.hpp"
+
+namespace jwt {
+    // A token the decoder under test and the reference disagreed on.
+    struct ShadowMismatch {
+        // The token's shape with its claim values blanked out, as a TrafficCapture would record it.
+        CapturedToken token{};
+
+        // Whether each side accepted the token. Both are true if they disagreed on the payload.
+        bool fastVerified{ false };
+        bool referenceVerified{ false };
+    };
+
+    // Decodes with a fast decoder and checks one call in every sampleEvery against the reference
+    // implementation built on OpenSSL's BIOs, on a thread of its own so callers never wait for the
+    // reference. Use it in place of jwt::decode while rolling a new decoder out. Samples that arrive
+    // while queueCapacity are already waiting are dropped rather than queued.
+    class ShadowVerifier {
+    public:
+        using Decoder = std::function<nlohmann::json(const std::string& jwt, const std::string& key, const std::set<std::string>& alg)>;
+
+        // Called on the verifier's thread.
+        using MismatchHandler = std::function<void(const ShadowMismatch& mismatch)>;
+
+        // The decoder defaults to jwt::decode.
+        explicit ShadowVerifier(size_t sampleEvery = 100, Decoder fast = {}, MismatchHandler handler = {}, size_t queueCapacity = 1024);
+        ~ShadowVerifier();
+
+        ShadowVerifier(const ShadowVerifier&) = delete;
+        ShadowVerifier& operator=(const ShadowVerifier&) = delete;
+
+        // Returns what the fast decoder does, exceptions included.
+        nlohmann::json decode(const std::string& jwt, const std::string& key, const std::set<std::string>& alg = {});
+
+        // Waits until every queued sample has been checked.
+        void drain();
+
+        uint64_t checked() const {
+            return m_checked.load(std::memory_order_relaxed);
+        }
+
+        uint64_t mismatches() const {
+            return m_mismatches.load(std::memory_order_relaxed);
+        }
+
+        uint64_t dropped() const {
+            return m_dropped.load(std::memory_order_relaxed);
+        }
+
+    private:
+        struct Sample {
+            std::string jwt;
+            std::string key;
+            std::set<std::string> alg;
+            nlohmann::json fast;
+        };
+
+        void sample(const std::string& jwt, const std::string& key, const std::set<std::string>& alg, const nlohmann::json& fast);
+        void run();
+
+        size_t m_sampleEvery;
+        Decoder m_fast;
+        MismatchHandler m_handler;
+        size_t m_queueCapacity;
+
+        std::mutex m_mutex{};
+        std::condition_variable m_wake{};
+        std::condition_variable m_idle{};
+        std::deque<Sample> m_queue{};
+        bool m_busy{ false };
+        bool m_stop{ false };
+
+        std::atomic<uint64_t> m_calls{ 0 };
+        std::atomic<uint64_t> m_checked{ 0 };
+        std::atomic<uint64_t> m_mismatches{ 0 };
+        std::atomic<uint64_t> m_dropped{ 0 };
+
+        std::thread m_thread;
+    };
+
+    namespace detail {
+        // decode as it was first written: every segment base64url decoded through OpenSSL's BIOs, then
+        // parsed as a whole. Returns a null json object on failure rather than throwing.
+        nlohmann::json referenceDecode(const std::string& jwt, const std::string& key, const std::set<std::string>& alg);
+    }
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <string>
+
+#include <simdjson.h>
+
+#include "backend.hpp"
+
+namespace jwt {
+    // A json backend using simdjson's on demand API. The parser and its padded input buffer are
+    // reused from token to token, so a decoded document is only valid until the next decode with
+    // the same backend, and a backend must not be shared between threads.
+    //
+    // On demand parsing only looks at what's asked for, so the header and payload are walked once
+    // in full to reject anything that isn't json, and the payload is rewound for the caller.
+    class SimdjsonBackend {
+    public:
+        using Document = simdjson::ondemand::document;
+
+        bool parseHeader(const std::string& header, std::string& alg) {
+            Document document{};
+
+            if (!iterate(header, document)) {
+                return false;
+            }
+
+            // Names the string_view type as little as possible: simdjson brings its own before C++17.
+            auto value = document["alg"].get_string();
+
+            if (value.error() != simdjson::SUCCESS) {
+                return false;
+            }
+
+            alg.assign(value.value_unsafe().data(), value.value_unsafe().size());
+            return true;
+        }
+
+        bool parse(std::string payload, Document& document) {
+            return iterate(payload, document);
+        }
+
+    private:
+        bool iterate(const std::string& json, Document& document) {
+            pad(json);
+
+            if (m_parser.iterate(m_buffer.data(), json.length(), m_buffer.size()).get(document) != simdjson::SUCCESS
+                || !validate(document) || !document.at_end())
+            {
+                return false;
+            }
+
+            document.rewind();
+            return true;
+        }
+
+        // Reads every value under value. Returns false if any of it isn't json.
+        template <typename Value>
+        static bool validate(Value& value) {
+            simdjson::ondemand::json_type type{};
+
+            if (value.type().get(type) != simdjson::SUCCESS) {
+                return false;
+            }
+
+            switch (type) {
+            case simdjson::ondemand::json_type::object: {
+                simdjson::ondemand::object object{};
+
+                if (value.get_object().get(object) != simdjson::SUCCESS) {
+                    return false;
+                }
+
+                for (auto field : object) {
+                    simdjson::ondemand::value child{};
+
+                    if (field.unescaped_key().error() != simdjson::SUCCESS || field.value().get(child) != simdjson::SUCCESS || !validate(child)) {
+                        return false;
+                    }
+                }
+
+                return true;
+            }
+            case simdjson::ondemand::json_type::array: {
+                simdjson::ondemand::array array{};
+
+                if (value.get_array().get(array) != simdjson::SUCCESS) {
+                    return false;
+                }
+
+                for (auto element : array) {
+                    simdjson::ondemand::value child{};
+
+                    if (element.get(child) != simdjson::SUCCESS || !validate(child)) {
+                        return false;
+                    }
+                }
+
+                return true;
+            }
+            case simdjson::ondemand::json_type::string:
+                return value.get_string().error() == simdjson::SUCCESS;
+            case simdjson::ondemand::json_type::number:
+                return value.get_number().error() == simdjson::SUCCESS;
+            case simdjson::ondemand::json_type::boolean:
+                return value.get_bool().error() == simdjson::SUCCESS;
+            case simdjson::ondemand::json_type::null: {
+                bool null{};
+
+                return value.is_null().get(null) == simdjson::SUCCESS && null;
+            }
+            default:
+                return false;
+            }
+        }
+
+        // simdjson reads up to SIMDJSON_PADDING bytes past the end of its input.
+        void pad(const std::string& json) {
+            auto needed = json.length() + simdjson::SIMDJSON_PADDING;
+
+            if (m_buffer.size() < needed) {
+                m_buffer.assign(needed, '\0');
+            }
+
+            json.copy(&m_buffer[0], json.length());
+        }
+
+        simdjson::ondemand::parser m_parser{};
+        std::string m_buffer{};
+    };
+}
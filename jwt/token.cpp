@@ -0,0 +1,97 @@
+#include "jwt.hpp"
+#include "token.hpp"
+
+using namespace std;
+using namespace nlohmann;
+
+namespace jwt {
+    namespace detail {
+        // Parses a base64url encoded segment, leaving out null if it's malformed.
+        void parseSegment(const char* begin, const char* end, json& out) {
+            if (!Base64UrlIterator::valid(begin, end)) {
+                return;
+            }
+
+            auto parsed = json::parse(Base64UrlIterator{ begin, end }, Base64UrlIterator{ end, end }, nullptr, false);
+
+            if (!parsed.is_discarded()) {
+                out = move(parsed);
+            }
+        }
+    }
+
+    Token::Token(const string& jwt)
+        : m_jwt(jwt)
+    {
+        m_firstPeriod = jwt.find_first_of('.');
+        m_secondPeriod = jwt.find_first_of('.', m_firstPeriod + 1);
+        m_valid = !jwt.empty() && m_firstPeriod != string::npos && m_secondPeriod != string::npos;
+    }
+
+    string Token::encodedHeader() const {
+        return m_valid ? m_jwt.substr(0, m_firstPeriod) : string{};
+    }
+
+    string Token::encodedPayload() const {
+        return m_valid ? m_jwt.substr(m_firstPeriod + 1, m_secondPeriod - m_firstPeriod - 1) : string{};
+    }
+
+    string Token::encodedSignature() const {
+        return m_valid ? m_jwt.substr(m_secondPeriod + 1) : string{};
+    }
+
+    const json& Token::header() const {
+        if (!m_headerDecoded && m_valid) {
+            detail::parseSegment(m_jwt.data(), m_jwt.data() + m_firstPeriod, m_header);
+        }
+
+        m_headerDecoded = true;
+        return m_header;
+    }
+
+    string Token::alg() const {
+        auto& theHeader = header();
+
+        if (!theHeader.is_object()) {
+            return string{};
+        }
+
+        auto it = theHeader.find("alg");
+
+        return it != theHeader.end() && it->is_string() ? it->get<string>() : string{};
+    }
+
+    const json& Token::payload() const {
+        if (!m_payloadDecoded && m_valid) {
+            detail::parseSegment(m_jwt.data() + m_firstPeriod + 1, m_jwt.data() + m_secondPeriod, m_payload);
+        }
+
+        m_payloadDecoded = true;
+        return m_payload;
+    }
+
+    const string& Token::signature() const {
+        if (!m_signatureDecoded && m_valid) {
+            if (!detail::b64urlDecode(m_jwt.data() + m_secondPeriod + 1, m_jwt.data() + m_jwt.length(), m_signature)) {
+                m_signature.clear();
+            }
+        }
+
+        m_signatureDecoded = true;
+        return m_signature;
+    }
+
+    bool Token::verify(const string& key, const set<string>& alg) const {
+        if (!m_valid) {
+            return false;
+        }
+
+        auto theAlg = this->alg();
+
+        if (theAlg.empty()) {
+            return false;
+        }
+
+        return detail::verifySignature(m_jwt, key, theAlg, alg, m_secondPeriod);
+    }
+}
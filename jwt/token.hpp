@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <set>
+
+#include "json.hpp"
+
+namespace jwt {
+    // A view of an encoded jwt that only remembers where its segments are. The header, payload and
+    // signature are each decoded the first time they're asked for and kept after that. The view
+    // refers to the original string, which has to outlive it, and isn't safe to share between
+    // threads until every part has been decoded.
+    class Token {
+    public:
+        explicit Token(const std::string& jwt);
+        explicit Token(std::string&& jwt) = delete;
+
+        // Returns false if the jwt doesn't have three segments.
+        bool valid() const {
+            return m_valid;
+        }
+
+        explicit operator bool() const {
+            return m_valid;
+        }
+
+        // The encoded segments, without the periods.
+        std::string encodedHeader() const;
+        std::string encodedPayload() const;
+        std::string encodedSignature() const;
+
+        // Returns a null json object if the header can't be decoded.
+        const nlohmann::json& header() const;
+
+        // The header's alg, or an empty string if it doesn't have one.
+        std::string alg() const;
+
+        // The payload as it is, call verify first. Returns a null json object if it can't be decoded.
+        const nlohmann::json& payload() const;
+
+        // The decoded signature bytes, empty if the signature isn't base64url.
+        const std::string& signature() const;
+
+        // Checks the header's alg against the key and the allowed algs and verifies the signature,
+        // without touching the payload. Returns false on failure.
+        bool verify(const std::string& key, const std::set<std::string>& alg = {}) const;
+
+    private:
+        const std::string& m_jwt;
+        size_t m_firstPeriod{ 0 };
+        size_t m_secondPeriod{ 0 };
+        bool m_valid{ false };
+
+        mutable bool m_headerDecoded{ false };
+        mutable bool m_payloadDecoded{ false };
+        mutable bool m_signatureDecoded{ false };
+        mutable nlohmann::json m_header{};
+        mutable nlohmann::json m_payload{};
+        mutable std::string m_signature{};
+    };
+}
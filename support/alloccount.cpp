@@ -0,0 +1,101 @@
+#include <cstdlib>
+#include <new>
+
+#include <openssl/crypto.h>
+
+#include "alloccount.hpp"
+
+// Counts every allocation made through operator new on each thread so tests and benchmarks can see
+// what a call allocates. It lives in its own file so the replacements are never inlined into them.
+thread_local size_t g_allocations = 0;
+
+// OpenSSL's allocations and how many of them are still live, if its allocator could be replaced
+// before it first allocated.
+thread_local size_t g_opensslAllocations = 0;
+thread_local long g_opensslLive = 0;
+bool g_opensslCounted = false;
+
+// Every malloc, calloc and realloc on each thread, whoever made it, where the C library lets us
+// count them. That covers operator new and OpenSSL as well as anything else.
+thread_local size_t g_mallocs = 0;
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+bool g_mallocsCounted = true;
+
+extern "C" {
+    void* __libc_malloc(size_t size);
+    void* __libc_calloc(size_t count, size_t size);
+    void* __libc_realloc(void* p, size_t size);
+
+    void* malloc(size_t size) {
+        ++g_mallocs;
+        return __libc_malloc(size);
+    }
+
+    void* calloc(size_t count, size_t size) {
+        ++g_mallocs;
+        return __libc_calloc(count, size);
+    }
+
+    void* realloc(void* p, size_t size) {
+        ++g_mallocs;
+        return __libc_realloc(p, size);
+    }
+}
+#else
+bool g_mallocsCounted = false;
+#endif
+
+void* operator new(size_t size) {
+    ++g_allocations;
+
+    if (auto p = malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+namespace {
+    void* opensslMalloc(size_t size, const char*, int) {
+        ++g_opensslAllocations;
+        ++g_opensslLive;
+        return malloc(size);
+    }
+
+    void* opensslRealloc(void* p, size_t size, const char*, int) {
+        if (size == 0) {
+            if (p != nullptr) {
+                --g_opensslLive;
+            }
+
+            free(p);
+            return nullptr;
+        }
+
+        ++g_opensslAllocations;
+
+        if (p == nullptr) {
+            ++g_opensslLive;
+        }
+
+        return realloc(p, size);
+    }
+
+    void opensslFree(void* p, const char*, int) {
+        if (p != nullptr) {
+            --g_opensslLive;
+        }
+
+        free(p);
+    }
+
+    struct CountOpenSSL {
+        CountOpenSSL() {
+            g_opensslCounted = CRYPTO_set_mem_functions(opensslMalloc, opensslRealloc, opensslFree) == 1;
+        }
+    } countOpenSSL{};
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+
+// The counts kept by alloccount.cpp, which replaces operator new, malloc and OpenSSL's allocator.
+// Only binaries built with the jwt_alloccount objects have them.
+
+// Every allocation made through operator new on this thread.
+extern thread_local size_t g_allocations;
+
+// OpenSSL's allocations on this thread and how many of them are still live, if g_opensslCounted.
+extern thread_local size_t g_opensslAllocations;
+extern thread_local long g_opensslLive;
+extern bool g_opensslCounted;
+
+// Every malloc, calloc and realloc on this thread, if g_mallocsCounted.
+extern thread_local size_t g_mallocs;
+extern bool g_mallocsCounted;
@@ -0,0 +1,105 @@
+#include <memory>
+
+#include <openssl/bio.h>
+#include <openssl/buffer.h>
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+
+#include "keys.hpp"
+
+using namespace std;
+
+namespace support {
+    namespace {
+        struct OpenSSLDeleter {
+            void operator()(BIO* bio) const {
+                BIO_free_all(bio);
+            }
+
+            void operator()(EVP_PKEY* pkey) const {
+                EVP_PKEY_free(pkey);
+            }
+
+            void operator()(EVP_PKEY_CTX* ctx) const {
+                EVP_PKEY_CTX_free(ctx);
+            }
+        };
+
+        template <typename T>
+        using OpenSSLHandle = unique_ptr<T, OpenSSLDeleter>;
+
+        EVP_PKEY* generate(const string& alg) {
+            auto isRSA = alg.compare(0, 2, "RS") == 0;
+            OpenSSLHandle<EVP_PKEY_CTX> ctx{ EVP_PKEY_CTX_new_id(isRSA ? EVP_PKEY_RSA : EVP_PKEY_EC, nullptr) };
+
+            if (!ctx || EVP_PKEY_keygen_init(ctx.get()) != 1) {
+                return nullptr;
+            }
+
+            if (isRSA) {
+                if (EVP_PKEY_CTX_set_rsa_keygen_bits(ctx.get(), 2048) != 1) {
+                    return nullptr;
+                }
+            }
+            else {
+                auto nid = alg == "ES256" ? NID_X9_62_prime256v1 : alg == "ES384" ? NID_secp384r1 : NID_secp521r1;
+
+                if (EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx.get(), nid) != 1) {
+                    return nullptr;
+                }
+            }
+
+            EVP_PKEY* pkey = nullptr;
+
+            if (EVP_PKEY_keygen(ctx.get(), &pkey) != 1) {
+                return nullptr;
+            }
+
+            return pkey;
+        }
+
+        string toString(BIO* bio) {
+            BUF_MEM* buf = nullptr;
+
+            BIO_get_mem_ptr(bio, &buf);
+
+            return string{ buf->data, buf->length };
+        }
+    }
+
+    bool makeKeyPair(const string& alg, KeyPair& keys) {
+        if (alg == "none") {
+            keys = KeyPair{};
+            return true;
+        }
+
+        if (alg.compare(0, 2, "HS") == 0) {
+            keys.signing = keys.verifying = "bench-secret-" + alg;
+            return true;
+        }
+
+        if (alg.compare(0, 2, "RS") != 0 && alg.compare(0, 2, "ES") != 0) {
+            return false;
+        }
+
+        OpenSSLHandle<EVP_PKEY> pkey{ generate(alg) };
+        OpenSSLHandle<BIO> privateBio{ BIO_new(BIO_s_mem()) };
+        OpenSSLHandle<BIO> publicBio{ BIO_new(BIO_s_mem()) };
+
+        if (!pkey || !privateBio || !publicBio) {
+            return false;
+        }
+
+        if (PEM_write_bio_PrivateKey(privateBio.get(), pkey.get(), nullptr, nullptr, 0, nullptr, nullptr) != 1 ||
+            PEM_write_bio_PUBKEY(publicBio.get(), pkey.get()) != 1) {
+            return false;
+        }
+
+        keys.signing = toString(privateBio.get());
+        keys.verifying = toString(publicBio.get());
+
+        return true;
+    }
+}
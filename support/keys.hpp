@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string>
+
+namespace support {
+    struct KeyPair {
+        // The key to sign with and the key to verify with. Both are the secret for HS algs and empty
+        // for none.
+        std::string signing{};
+        std::string verifying{};
+    };
+
+    // Makes a fresh key pair for the alg: a 2048 bit RSA key for RS algs and a key on the alg's curve
+    // for ES algs. Returns false on failure.
+    bool makeKeyPair(const std::string& alg, KeyPair& keys);
+}
@@ -1,9 +1,33 @@
+#include <cstdint>
+#include <locale>
 #include <string>
+#include <vector>
 
 #define CATCH_CONFIG_MAIN
 #include "catch.hpp"
 #include "jwt/jwt.hpp"
+#include "jwt/claims.hpp"
+#include "jwt/policy.hpp"
+#include "jwt/scopes.hpp"
+#include "jwt/projection.hpp"
+#include "jwt/backend.hpp"
+#include "jwt/token.hpp"
+#include "jwt/peek.hpp"
+#include "jwt/cache.hpp"
+#include "jwt/arena.hpp"
+#include "jwt/instrument.hpp"
+#include "jwt/metrics.hpp"
+#include "jwt/capture.hpp"
+#include "jwt/shadow.hpp"
 #include "jwt/json.hpp"
+#include "support/alloccount.hpp"
+#include "support/keys.hpp"
+
+#include <openssl/err.h>
+
+#ifdef JWT_SIMDJSON
+#include "jwt/simdjson.hpp"
+#endif
 
 using namespace std;
 using namespace nlohmann;
@@ -413,6 +437,87 @@ ehde/zUxo6UvS7UrBQIDAQAB
     }
 }
 
+SCENARIO("OpenSSL's error queue is drained after every call into it") {
+    GIVEN("A token signed with an RS256 key pair") {
+        json payload{ { "sub", "1234567890" }, { "name", "John Doe" }, { "admin", true } };
+        support::KeyPair keys{};
+
+        REQUIRE(support::makeKeyPair("RS256", keys));
+
+        auto encoded = jwt::encode(payload, keys.signing, "RS256");
+
+        WHEN("a stream of invalid tokens is decoded") {
+            auto tampered = encoded.substr(0, encoded.size() - 4) + "AAAA";
+            auto badKey = keys.verifying.substr(0, 100);
+            auto live = g_opensslLive;
+            auto clean = true;
+            unsigned long error = 0;
+
+            for (int i = 0; i < 500; ++i) {
+                jwt::decode(tampered, keys.verifying, { "RS256" });
+                clean = clean && ERR_peek_error() == 0;
+
+                jwt::decode(encoded, badKey, { "RS256" });
+                clean = clean && ERR_peek_error() == 0;
+                error = jwt::lastOpenSSLError();
+
+                // Let OpenSSL settle any caches it fills on first use.
+                if (i == 10) {
+                    live = g_opensslLive;
+                }
+            }
+
+            THEN("OpenSSL's error queue is drained every time and its memory stays flat") {
+                REQUIRE(clean);
+                REQUIRE(error != 0);
+                REQUIRE(g_opensslCounted);
+                REQUIRE(g_opensslLive == live);
+            }
+        }
+    }
+}
+
+SCENARIO("PEM signatures are made and checked without copying the token") {
+    GIVEN("A token signed with an RS256 key pair") {
+        json payload{ { "sub", "1234567890" }, { "name", "John Doe" }, { "admin", true } };
+        support::KeyPair keys{};
+
+        REQUIRE(support::makeKeyPair("RS256", keys));
+
+        auto encoded = jwt::encode(payload, keys.signing, "RS256");
+
+        WHEN("its signature is made and checked directly") {
+            string message{ encoded.substr(0, encoded.rfind('.')) };
+            string signature{ encoded.substr(encoded.rfind('.') + 1) };
+
+            auto before = g_allocations;
+            auto resigned = jwt::detail::signPEM(message, keys.signing, "RS256");
+            auto signAllocations = g_allocations - before;
+
+            before = g_allocations;
+            auto verified = jwt::detail::verifyPEM(message, signature, keys.verifying, "RS256");
+            auto verifyAllocations = g_allocations - before;
+
+            auto raw = jwt::detail::b64decode(signature);
+
+            before = g_allocations;
+            jwt::detail::b64encode(raw.data(), raw.size());
+            auto encodeAllocations = g_allocations - before;
+
+            before = g_allocations;
+            jwt::detail::b64decode(signature);
+            auto decodeAllocations = g_allocations - before;
+
+            THEN("nothing is allocated beyond the signature itself") {
+                REQUIRE(resigned == signature);
+                REQUIRE(verified);
+                REQUIRE(signAllocations == encodeAllocations + 1);
+                REQUIRE(verifyAllocations == decodeAllocations);
+            }
+        }
+    }
+}
+
 SCENARIO("JWT's can be encoded and decoded using RS384") {
     auto payload = R"(
         {
@@ -702,4 +807,1478 @@ hdCHLPADaPT8ghKSn4knIKTcUrj8apbtkiEZ+7wtltyHEah825dTCSeLspOLfDTN
             }
         }
     }
-}
\ No newline at end of file
+}
+
+namespace {
+    // The most one call may allocate through operator new, which is all the library's own doing.
+    // What OpenSSL mallocs is down to its version, so that's only reported.
+    struct AllocationBudget {
+        const char* alg;
+        size_t encode;
+        size_t decode;
+        size_t verify;
+    };
+
+    // A 4 claim payload with freshly made keys: 2048 bit RSA and the alg's own curve for ES.
+    const AllocationBudget allocationBudgets[] = {
+        { "none", 5, 27, 0 },
+        { "HS256", 6, 28, 0 },
+        { "HS384", 6, 28, 0 },
+        { "HS512", 6, 28, 0 },
+        { "RS256", 7, 29, 1 },
+        { "RS384", 7, 29, 1 },
+        { "RS512", 7, 29, 1 },
+        { "ES256", 7, 29, 1 },
+        { "ES384", 7, 29, 1 },
+        { "ES512", 7, 29, 1 }
+    };
+
+    struct Allocations {
+        size_t news;
+        size_t mallocs;
+    };
+
+    template <typename Fn>
+    Allocations countAllocations(Fn fn) {
+        auto news = g_allocations;
+        auto mallocs = g_mallocs;
+
+        fn();
+
+        return Allocations{ g_allocations - news, g_mallocs - mallocs };
+    }
+}
+
+SCENARIO("Encode, decode and verify stay within their allocation budgets", "[allocations]") {
+    GIVEN("A payload and a key pair for every alg") {
+        json payload{ { "sub", "1234567890" }, { "name", "John Doe" }, { "admin", true }, { "iat", 1516239022 } };
+
+        for (auto& budget : allocationBudgets) {
+            WHEN(string{ budget.alg } + " tokens are encoded, decoded and verified once OpenSSL is warm") {
+                support::KeyPair keys{};
+
+                REQUIRE(support::makeKeyPair(budget.alg, keys));
+
+                // Let OpenSSL fill whatever it caches on first use.
+                auto encoded = jwt::encode(payload, keys.signing, budget.alg);
+
+                jwt::decode(encoded, keys.verifying);
+                jwt::verify(encoded, keys.verifying);
+
+                auto encode = countAllocations([&]() { encoded = jwt::encode(payload, keys.signing, budget.alg); });
+                json decoded{};
+                auto decode = countAllocations([&]() { decoded = jwt::decode(encoded, keys.verifying); });
+                auto status = jwt::VerifyStatus::Malformed;
+                auto verify = countAllocations([&]() { status = jwt::verify(encoded, keys.verifying); });
+
+                THEN("each call allocates no more through operator new than its budget") {
+                    // The mallocs are only context, and 0 where they can't be counted.
+                    INFO(budget.alg << " encode " << encode.news << "/" << encode.mallocs << ", decode " << decode.news << "/" << decode.mallocs
+                        << ", verify " << verify.news << "/" << verify.mallocs << " (operator new/malloc)");
+
+                    REQUIRE(decoded == payload);
+                    REQUIRE(status == jwt::VerifyStatus::Ok);
+                    REQUIRE(encode.news <= budget.encode);
+                    REQUIRE(decode.news <= budget.decode);
+                    REQUIRE(verify.news <= budget.verify);
+                }
+            }
+        }
+    }
+}
+
+struct TestClaims {
+    string sub{};
+    bool admin{};
+    int64_t iat{};
+    string tenant{};
+    vector<string> aud{};
+};
+
+namespace jwt {
+    template <>
+    struct ClaimSchema<TestClaims> {
+        template <typename Field>
+        static void fields(TestClaims& claims, Field& field) {
+            field("sub", claims.sub, Claim::Required);
+            field("admin", claims.admin, Claim::Required);
+            field("iat", claims.iat, Claim::Optional);
+            field("tenant_id", claims.tenant, Claim::Optional);
+            field("aud", claims.aud, Claim::Optional);
+        }
+    };
+}
+
+SCENARIO("JWT's can be decoded straight into a claims struct") {
+    string key{ "secret" };
+    auto payload = R"(
+        {
+            "sub": "1234567890",
+            "name": "John Doe",
+            "admin": true,
+            "iat": 1516239022,
+            "aud": [ "api", "gateway" ],
+            "profile": { "tags": [ 1, 2, { "deep": [] } ] }
+        }
+    )"_json;
+
+    GIVEN("An encoded payload") {
+        auto encoded = jwt::encode(payload, key, "HS256");
+
+        WHEN("it is decoded into a claims struct") {
+            TestClaims claims{};
+            auto decoded = jwt::decode(encoded, key, claims, { "HS256" });
+
+            THEN("the schema fields are filled in and the rest is skipped") {
+                REQUIRE(decoded);
+                REQUIRE(claims.sub == "1234567890");
+                REQUIRE(claims.admin == true);
+                REQUIRE(claims.iat == 1516239022);
+                REQUIRE(claims.tenant.empty());
+                REQUIRE(claims.aud == (vector<string>{ "api", "gateway" }));
+            }
+        }
+
+        WHEN("it is decoded with the wrong key") {
+            TestClaims claims{};
+
+            THEN("it fails") {
+                REQUIRE_FALSE(jwt::decode(encoded, "wrong", claims));
+            }
+        }
+    }
+
+    GIVEN("A payload missing a required claim") {
+        auto encoded = jwt::encode(json{ { "sub", "1234567890" } }, key, "HS256");
+
+        WHEN("it is decoded into a claims struct") {
+            TestClaims claims{};
+
+            THEN("it fails") {
+                REQUIRE_FALSE(jwt::decode(encoded, key, claims));
+            }
+        }
+    }
+
+    GIVEN("A payload with a claim of the wrong type") {
+        auto encoded = jwt::encode(json{ { "sub", 1234567890 }, { "admin", true } }, key, "HS256");
+
+        WHEN("it is decoded into a claims struct") {
+            TestClaims claims{};
+
+            THEN("it fails") {
+                REQUIRE_FALSE(jwt::decode(encoded, key, claims));
+            }
+        }
+    }
+}
+
+SCENARIO("Authorization policies can be compiled and evaluated against claims") {
+    auto payload = R"(
+        {
+            "sub": "1234567890",
+            "aud": [ "api", "gateway" ],
+            "scope": "read write",
+            "tenant_id": "acme",
+            "exp": 1700000000,
+            "realm": { "roles": [ "admin" ] }
+        }
+    )"_json;
+
+    GIVEN("A policy over several claims and a parameter") {
+        jwt::Policy policy{};
+        auto compiled = policy.compile(R"(aud contains "api" and scope has "read" and tenant_id == $tenant and exp > 1600000000)");
+
+        THEN("it compiles") {
+            REQUIRE(compiled);
+            REQUIRE(policy.param("tenant") == 0);
+        }
+
+        WHEN("it is evaluated with a matching parameter") {
+            THEN("it allows the payload") {
+                REQUIRE(policy.evaluate(payload, { "acme" }));
+            }
+        }
+
+        WHEN("it is evaluated with a different parameter") {
+            THEN("it denies the payload") {
+                REQUIRE_FALSE(policy.evaluate(payload, { "other" }));
+            }
+        }
+
+        WHEN("it is evaluated without its parameter") {
+            THEN("it denies the payload") {
+                REQUIRE_FALSE(policy.evaluate(payload));
+            }
+        }
+    }
+
+    GIVEN("A policy using or, not and nested claims") {
+        jwt::Policy policy{};
+        policy.compile(R"(not (scope has "wri" or aud contains "admin") and realm.roles contains "admin")");
+
+        THEN("it evaluates") {
+            REQUIRE(policy.evaluate(payload));
+            REQUIRE_FALSE(policy.evaluate(json{ { "scope", "write" } }));
+        }
+    }
+
+    GIVEN("An invalid policy") {
+        jwt::Policy policy{};
+
+        THEN("it fails to compile and denies everything") {
+            REQUIRE_FALSE(policy.compile(R"(aud contains and)"));
+            REQUIRE_FALSE(policy.error().empty());
+            REQUIRE_FALSE(policy.evaluate(payload));
+        }
+    }
+
+    GIVEN("Rules that parse up to a character the lexer doesn't know") {
+        jwt::Policy policy{};
+        json admin = { { "sub", "x" }, { "admin", false } };
+
+        THEN("they fail to compile rather than dropping the rest of the rule") {
+            for (auto rule : { R"(sub == "x" && admin == true)", R"(sub == "x" | admin == true)", R"(sub == "x" ; garbage)" }) {
+                REQUIRE_FALSE(policy.compile(rule));
+                REQUIRE_FALSE(policy.error().empty());
+                REQUIRE_FALSE(policy.evaluate(admin));
+            }
+        }
+    }
+
+    GIVEN("Rules nested deeper than MaxDepth") {
+        jwt::Policy policy{};
+        string nots{};
+        string parens{};
+
+        for (size_t i = 0; i < 100000; ++i) {
+            nots += "not ";
+            parens += "(";
+        }
+
+        THEN("they fail to compile") {
+            REQUIRE_FALSE(policy.compile(nots + R"(sub == "x")"));
+            REQUIRE(policy.error() == "rule is nested too deeply");
+            REQUIRE_FALSE(policy.compile(parens + R"(sub == "x")"));
+            REQUIRE(policy.error() == "rule is nested too deeply");
+        }
+    }
+
+    GIVEN("Rules with more literals than MaxConstants") {
+        jwt::Policy policy{};
+        string rule{ "n == 0" };
+
+        for (size_t i = 1; i < jwt::Policy::MaxConstants; ++i) {
+            rule += " or n == " + to_string(i);
+        }
+
+        THEN("they fail to compile rather than wrapping the literal index") {
+            REQUIRE(policy.compile(rule));
+            REQUIRE(policy.evaluate({ { "n", 65534 } }));
+            REQUIRE_FALSE(policy.compile(rule + " or n == 65535"));
+            REQUIRE(policy.error() == "too many literals");
+            REQUIRE_FALSE(policy.evaluate({ { "n", 0 } }));
+        }
+    }
+}
+
+SCENARIO("Scope claims can be interned into bitsets") {
+    string key{ "secret" };
+    jwt::ScopeVocabulary vocabulary{};
+
+    for (auto scope : { "read", "write", "delete", "admin", "billing" }) {
+        vocabulary.add(scope);
+    }
+
+    GIVEN("A token with a scope string and a roles array") {
+        auto payload = R"(
+            {
+                "sub": "1234567890",
+                "scope": "read  write unknown",
+                "roles": [ "admin", "read write" ]
+            }
+        )"_json;
+        auto encoded = jwt::encode(payload, key, "HS256");
+
+        WHEN("it is decoded with the vocabulary") {
+            jwt::Scopes scopes{};
+            auto decoded = jwt::decode(encoded, key, vocabulary, scopes);
+
+            jwt::Scopes expected{};
+            jwt::Scopes readAdmin{};
+            jwt::Scopes readBilling{};
+            jwt::Scopes deleteWrite{};
+
+            REQUIRE(vocabulary.set({ "read", "write", "admin" }, expected));
+            REQUIRE(vocabulary.set({ "read", "admin" }, readAdmin));
+            REQUIRE(vocabulary.set({ "read", "billing" }, readBilling));
+            REQUIRE(vocabulary.set({ "delete", "write" }, deleteWrite));
+
+            THEN("the known scopes are set") {
+                REQUIRE(decoded == payload);
+                REQUIRE(scopes == expected);
+                REQUIRE(jwt::hasAll(scopes, readAdmin));
+                REQUIRE_FALSE(jwt::hasAll(scopes, readBilling));
+                REQUIRE(jwt::hasAny(scopes, deleteWrite));
+            }
+        }
+
+        WHEN("a required set names a scope the vocabulary doesn't have") {
+            jwt::Scopes required{};
+
+            THEN("it can't be made, rather than requiring fewer scopes") {
+                REQUIRE_FALSE(vocabulary.set({ "admin", "typo" }, required));
+                REQUIRE(required.none());
+            }
+        }
+
+        WHEN("it is decoded with the wrong key") {
+            jwt::Scopes scopes{};
+            auto decoded = jwt::decode(encoded, "wrong", vocabulary, scopes);
+
+            THEN("no scopes are set") {
+                REQUIRE(decoded == nullptr);
+                REQUIRE(scopes.none());
+            }
+        }
+    }
+}
+
+SCENARIO("Only the projected claims are extracted from a payload") {
+    string key{ "secret" };
+    auto payload = R"(
+        {
+            "profile": { "bio": "a \"quoted\" bio", "history": [ 1, [ 2, 3 ], { "x": [] } ] },
+            "sub": "1234567890",
+            "exp": 1700000000,
+            "tenant": { "id": "acme", "a/b": true },
+            "aud": [ "api", "gateway" ]
+        }
+    )"_json;
+    jwt::Projection projection{ "/sub", "/exp", "/tenant/id", "/tenant/a~1b", "/aud/1", "/missing" };
+
+    GIVEN("An encoded payload") {
+        auto encoded = jwt::encode(payload, key, "HS256");
+
+        WHEN("it is decoded with a projection") {
+            jwt::ProjectedClaims claims{};
+            auto decoded = jwt::decode(encoded, key, projection, claims, { "HS256" });
+
+            THEN("the requested values are returned as views") {
+                REQUIRE(decoded);
+                REQUIRE(claims.size() == 6);
+                REQUIRE(claims[0].str() == "1234567890");
+                REQUIRE(claims[1].integer() == 1700000000);
+                REQUIRE(claims[2].str() == "acme");
+                REQUIRE(claims[3].boolean());
+                REQUIRE(claims[4].str() == "gateway");
+                REQUIRE(claims[5].empty());
+            }
+        }
+
+        WHEN("it is decoded with the wrong key") {
+            jwt::ProjectedClaims claims{};
+
+            THEN("it fails") {
+                REQUIRE_FALSE(jwt::decode(encoded, "wrong", projection, claims));
+            }
+        }
+    }
+
+    GIVEN("A projection of a whole subtree") {
+        jwt::Projection subtree{ "/tenant", "" };
+        jwt::ProjectedClaims claims{};
+
+        WHEN("a payload is scanned") {
+            auto scanned = claims.scan(subtree, payload.dump());
+
+            THEN("the subtree can be parsed on demand") {
+                REQUIRE(scanned);
+                REQUIRE(claims[0].json() == payload["tenant"]);
+                REQUIRE(claims[1].json() == payload);
+            }
+        }
+    }
+
+    GIVEN("A malformed payload") {
+        jwt::ProjectedClaims claims{};
+
+        THEN("scanning fails") {
+            REQUIRE_FALSE(claims.scan(projection, R"({"profile": [1, 2, "sub": 1})"));
+        }
+
+        THEN("scanning fails even when nothing is projected") {
+            jwt::Projection empty{};
+
+            REQUIRE_FALSE(claims.scan(empty, R"({"profile": [1, 2, "sub": 1})"));
+            REQUIRE(claims.scan(empty, payload.dump()));
+            REQUIRE(claims.size() == 0);
+        }
+    }
+
+    GIVEN("Payloads with values that aren't json") {
+        jwt::ProjectedClaims claims{};
+
+        THEN("scanning fails whether or not the value was asked for") {
+            for (auto bad : { R"({"sub": nope})", R"({"sub": tru})", R"({"exp": 01})", R"({"exp": 1.})", R"({"exp": -})", R"({"exp": 1e})",
+                R"({"other": 1x, "sub": "a"})", R"({"sub": "a\q"})", R"({"sub": "\u12"})", R"({"sub": "a", "exp": 1} trailing)" })
+            {
+                REQUIRE_FALSE(claims.scan(projection, bad));
+            }
+
+            REQUIRE(claims.scan(projection, R"({"sub": "é", "exp": -1.5e+3, "other": [true, false, null, 0]})"));
+            REQUIRE(claims[1].number() == -1500.0);
+        }
+    }
+
+    GIVEN("A projected view of something that isn't json") {
+        jwt::JsonView view{ "nope", 4 };
+
+        THEN("parsing it gives a null json object rather than throwing") {
+            REQUIRE(view.json() == nullptr);
+        }
+    }
+
+    GIVEN("A payload with repeated keys") {
+        string repeated{ R"({"sub": "first", "tenant": {"id": "a", "a/b": true}, "sub": "second", "tenant": {"id": "b"}})" };
+        jwt::ProjectedClaims claims{};
+
+        WHEN("it is scanned") {
+            auto scanned = claims.scan(projection, repeated);
+
+            THEN("the last of each wins, as it does when decoding") {
+                auto decoded = json::parse(repeated);
+
+                REQUIRE(scanned);
+                REQUIRE(claims[0].str() == decoded["sub"].get<string>());
+                REQUIRE(claims[2].str() == decoded["tenant"]["id"].get<string>());
+                REQUIRE(claims[3].empty());
+                REQUIRE_FALSE(decoded["tenant"].contains("a/b"));
+            }
+        }
+    }
+}
+
+SCENARIO("JWT's can be decoded with a pluggable json backend") {
+    string key{ "secret" };
+    auto payload = R"(
+        {
+            "sub": "1234567890",
+            "name": "John Doe",
+            "admin": true
+        }
+    )"_json;
+
+    GIVEN("An encoded payload") {
+        auto encoded = jwt::encode(payload, key, "HS256");
+
+        WHEN("it is decoded with the nlohmann backend") {
+            jwt::NlohmannBackend backend{};
+            json decoded{};
+
+            THEN("it equals the payload") {
+                REQUIRE(jwt::decode(encoded, key, backend, decoded, { "HS256" }));
+                REQUIRE(decoded == payload);
+            }
+        }
+
+        WHEN("it is decoded with the nlohmann backend and the wrong key") {
+            jwt::NlohmannBackend backend{};
+            json decoded{};
+
+            THEN("it fails") {
+                REQUIRE_FALSE(jwt::decode(encoded, "wrong", backend, decoded));
+            }
+        }
+
+#ifdef JWT_SIMDJSON
+        WHEN("it is decoded with the simdjson backend") {
+            jwt::SimdjsonBackend backend{};
+            jwt::SimdjsonBackend::Document decoded{};
+
+            THEN("the claims can be read from the document") {
+                REQUIRE(jwt::decode(encoded, key, backend, decoded, { "HS256" }));
+
+                std::string_view sub{};
+                bool admin{};
+
+                REQUIRE(decoded["sub"].get_string().get(sub) == simdjson::SUCCESS);
+                REQUIRE(string(sub.data(), sub.size()) == "1234567890");
+                REQUIRE(decoded["admin"].get_bool().get(admin) == simdjson::SUCCESS);
+                REQUIRE(admin);
+            }
+        }
+
+        WHEN("it is decoded with the simdjson backend and the wrong key") {
+            jwt::SimdjsonBackend backend{};
+            jwt::SimdjsonBackend::Document decoded{};
+
+            THEN("it fails") {
+                REQUIRE_FALSE(jwt::decode(encoded, "wrong", backend, decoded));
+            }
+        }
+#endif
+    }
+
+    GIVEN("Properly signed tokens whose payload isn't json") {
+        auto header = jwt::detail::b64encode((const uint8_t*)R"({"alg":"HS256"})", 15);
+
+        for (string bad : { R"({"sub": nope})", R"({"sub": "1234567890",)", R"({"sub": 12x})", R"({"sub": 1} trailing)", R"([tru])" }) {
+            auto message = header + "." + jwt::detail::b64encode((const uint8_t*)bad.data(), bad.length());
+            auto token = message + "." + jwt::detail::signHMAC(message, key, "HS256");
+
+            WHEN("'" + bad + "' is decoded with the nlohmann backend") {
+                jwt::NlohmannBackend backend{};
+                json decoded{};
+
+                THEN("it fails") {
+                    REQUIRE_FALSE(jwt::decode(token, key, backend, decoded));
+                }
+            }
+
+#ifdef JWT_SIMDJSON
+            WHEN("'" + bad + "' is decoded with the simdjson backend") {
+                jwt::SimdjsonBackend backend{};
+                jwt::SimdjsonBackend::Document decoded{};
+
+                THEN("it fails") {
+                    REQUIRE_FALSE(jwt::decode(token, key, backend, decoded));
+                }
+            }
+#endif
+        }
+    }
+}
+
+SCENARIO("Payloads are parsed while they are base64url decoded") {
+    string key{ "secret" };
+
+    GIVEN("Payloads of sizes that don't line up with the decoder's blocks") {
+        for (size_t size : { 0, 1, 2, 47, 48, 49, 4095, 16385 }) {
+            json payload{ { "sub", "1234567890" }, { "blob", string(size, 'x') } };
+            auto encoded = jwt::encode(payload, key, "HS256");
+
+            WHEN("one of " + to_string(size) + " bytes is decoded") {
+                auto decoded = jwt::decode(encoded, key);
+
+                THEN("they equal the payload") {
+                    REQUIRE(decoded == payload);
+                }
+            }
+        }
+    }
+
+    GIVEN("A token whose payload isn't base64url") {
+        auto encoded = jwt::encode(json{ { "sub", "1234567890" } }, "", "none");
+        auto firstPeriod = encoded.find('.');
+
+        encoded[firstPeriod + 2] = '*';
+
+        WHEN("it is decoded") {
+            auto decoded = jwt::decode(encoded, "");
+
+            THEN("it returns null") {
+                REQUIRE(decoded == nullptr);
+            }
+        }
+    }
+}
+
+SCENARIO("Payloads are serialized straight into base64url") {
+    GIVEN("Payloads of every length modulo 3") {
+        for (size_t size : { 0, 1, 2, 3, 4, 5, 1000, 1001, 1002 }) {
+            json payload{ { "blob", string(size, 'x') }, { "utf8", u8"é中" } };
+
+            WHEN("one of " + to_string(size) + " bytes is encoded") {
+                auto encoded = jwt::encode(payload, "", "none");
+
+                THEN("the token is unpadded base64url that decodes back to the payload") {
+                    REQUIRE(encoded.find_first_of("+/=") == string::npos);
+                    REQUIRE(jwt::decode(encoded, "") == payload);
+                }
+            }
+        }
+    }
+}
+
+SCENARIO("Tokens can be inspected lazily before they are verified") {
+    string key{ "secret" };
+    auto payload = R"(
+        {
+            "sub": "1234567890",
+            "name": "John Doe",
+            "admin": true
+        }
+    )"_json;
+
+    GIVEN("An encoded payload") {
+        auto encoded = jwt::encode(payload, key, "HS384");
+        jwt::Token token{ encoded };
+
+        THEN("the header can be read without verifying") {
+            REQUIRE(token.valid());
+            REQUIRE(token.alg() == "HS384");
+            REQUIRE(token.header()["typ"] == "JWT");
+            REQUIRE(token.signature().size() == 48);
+        }
+
+        WHEN("it is verified with the right key") {
+            THEN("the payload can be trusted") {
+                REQUIRE(token.verify(key, { "HS384" }));
+                REQUIRE(token.payload() == payload);
+            }
+        }
+
+        WHEN("it is verified with the wrong key or algorithms") {
+            THEN("verification fails") {
+                REQUIRE_FALSE(token.verify("wrong"));
+                REQUIRE_FALSE(token.verify(key, { "HS256" }));
+            }
+        }
+    }
+
+    GIVEN("Something that isn't a jwt") {
+        string encoded{ "not a jwt" };
+        jwt::Token token{ encoded };
+
+        THEN("nothing decodes") {
+            REQUIRE_FALSE(token.valid());
+            REQUIRE(token.header() == nullptr);
+            REQUIRE(token.payload() == nullptr);
+            REQUIRE_FALSE(token.verify(""));
+        }
+    }
+}
+
+SCENARIO("Header fields and claims can be peeked at without verifying") {
+    GIVEN("A token with a kid in its header") {
+        // {"alg":"RS256","kid":"key\/1\u00e9","typ":"JWT","x5c":["a",{"b":"}"}]}
+        // {"profile":{"iss":"nested"},"iss":"https://issuer.example","sub":"1234567890"}
+        string encoded{
+            "eyJhbGciOiJSUzI1NiIsImtpZCI6ImtleVwvMVx1MDBlOSIsInR5cCI6IkpXVCIsIng1YyI6WyJhIix7ImIiOiJ9In1dfQ."
+            "eyJwcm9maWxlIjp7ImlzcyI6Im5lc3RlZCJ9LCJpc3MiOiJodHRwczovL2lzc3Vlci5leGFtcGxlIiwic3ViIjoiMTIzNDU2Nzg5MCJ9."
+            "c2lnbmF0dXJl"
+        };
+
+        WHEN("its header is peeked at") {
+            jwt::PeekedHeader header{};
+            auto peeked = jwt::peekHeader(encoded, header);
+
+            THEN("alg, kid and typ are unescaped") {
+                REQUIRE(peeked);
+                REQUIRE(header.alg == "RS256");
+                REQUIRE(header.kid == u8"key/1é");
+                REQUIRE(header.typ == "JWT");
+            }
+        }
+
+        WHEN("its header is peeked at with a smaller size limit") {
+            jwt::PeekedHeader header{};
+
+            THEN("it is rejected") {
+                REQUIRE_FALSE(jwt::peekHeader(encoded, header, 32));
+            }
+        }
+
+        WHEN("its issuer is peeked at") {
+            jwt::PeekedClaim iss{};
+            jwt::PeekedClaim missing{};
+
+            THEN("only the top level claim is found") {
+                REQUIRE(jwt::peekClaim(encoded, "iss", iss));
+                REQUIRE(iss.value == "https://issuer.example");
+                REQUIRE_FALSE(jwt::peekClaim(encoded, "aud", missing));
+            }
+        }
+    }
+
+    GIVEN("Something that isn't a jwt") {
+        jwt::PeekedHeader header{};
+
+        THEN("peeking fails") {
+            REQUIRE_FALSE(jwt::peekHeader("not a jwt", header));
+            REQUIRE_FALSE(jwt::peekHeader("e30.e30", header));
+            REQUIRE_FALSE(jwt::peekHeader("e3.e30.", header));
+        }
+    }
+
+    GIVEN("Tokens with a peeked member twice") {
+        auto segment = [](const string& json) {
+            return jwt::detail::b64encode((const uint8_t*)json.data(), json.length());
+        };
+        auto payload = segment(R"({"sub":"1234567890"})");
+
+        THEN("peeking fails rather than seeing a different member than decode would") {
+            jwt::PeekedHeader header{};
+            jwt::PeekedClaim iss{};
+
+            REQUIRE_FALSE(jwt::peekHeader(segment(R"({"alg":"HS256","alg":"RS256"})") + "." + payload + ".c2ln", header));
+            REQUIRE_FALSE(jwt::peekHeader(segment(R"({"alg":"","alg":"RS256"})") + "." + payload + ".c2ln", header));
+            REQUIRE_FALSE(jwt::peekHeader(segment(R"({"kid":1,"typ":"JWT","kid":"a"})") + "." + payload + ".c2ln", header));
+            REQUIRE(jwt::verify(segment(R"({"alg":"HS256","alg":"RS256"})") + "." + payload + ".c2ln", "secret") == jwt::VerifyStatus::Malformed);
+            REQUIRE_FALSE(jwt::peekClaim(segment(R"({"alg":"none"})") + "." + segment(R"({"iss":"a","sub":"b","iss":"c"})") + ".", "iss", iss));
+        }
+    }
+
+    GIVEN("Claims with names around the longest that can be peeked") {
+        json payload{ { string(32, 'n'), "fits" }, { string(33, 'n'), "too long" } };
+        auto encoded = jwt::encode(payload, "secret", "HS256");
+        jwt::PeekedClaim claim{};
+
+        THEN("only names of up to 32 bytes are found") {
+            REQUIRE(jwt::peekClaim(encoded, string(32, 'n').c_str(), claim));
+            REQUIRE(claim.value == "fits");
+            REQUIRE_FALSE(jwt::peekClaim(encoded, string(33, 'n').c_str(), claim));
+        }
+    }
+
+    GIVEN("A header whose encoding doesn't end on a whole block") {
+        // 29 bytes, encoded as 39 characters.
+        auto encoded = jwt::detail::b64encode((const uint8_t*)R"({"alg":"HS256","typ":"JWTXY"})", 29) + ".e30.";
+
+        THEN("the size limit is held to the exact decoded size") {
+            jwt::PeekedHeader header{};
+
+            REQUIRE_FALSE(jwt::peekHeader(encoded, header, 28));
+            REQUIRE(jwt::peekHeader(encoded, header, 29));
+            REQUIRE(header.alg == "HS256");
+        }
+    }
+}
+
+SCENARIO("Keys are resolved once per distinct header") {
+    GIVEN("A header cache with room for one header") {
+        size_t resolved = 0;
+
+        jwt::HeaderCache cache{ [&](const string& kid, jwt::Alg alg, string& key) {
+            ++resolved;
+
+            if (!kid.empty() || (alg != jwt::Alg::HS256 && alg != jwt::Alg::HS384)) {
+                return false;
+            }
+
+            key = "secret";
+            return true;
+        }, 1 };
+
+        json payload{ { "sub", "1234567890" } };
+        auto hs256 = jwt::encode(payload, "secret", "HS256");
+        auto hs384 = jwt::encode(payload, "secret", "HS384");
+
+        WHEN("tokens with the same header are decoded") {
+            auto first = jwt::decode(hs256, cache);
+            auto second = jwt::decode(hs256, cache);
+
+            THEN("the header is only parsed and resolved once") {
+                REQUIRE(first == payload);
+                REQUIRE(second == payload);
+                REQUIRE(resolved == 1);
+                REQUIRE(cache.hits() == 1);
+                REQUIRE(cache.misses() == 1);
+            }
+        }
+
+        WHEN("tokens with different headers are decoded") {
+            REQUIRE(jwt::decode(hs256, cache) == payload);
+            REQUIRE(jwt::decode(hs384, cache) == payload);
+            REQUIRE(jwt::decode(hs256, cache) == payload);
+
+            THEN("the older header is evicted") {
+                REQUIRE(resolved == 3);
+                REQUIRE(cache.hits() == 0);
+            }
+        }
+
+        WHEN("a token signed with another key or an unresolvable alg is decoded") {
+            THEN("it is rejected") {
+                REQUIRE(jwt::decode(jwt::encode(payload, "other", "HS256"), cache) == nullptr);
+                REQUIRE(jwt::decode(jwt::encode(payload, "secret", "HS512"), cache) == nullptr);
+                REQUIRE(jwt::decode(hs256, cache, { "HS384" }) == nullptr);
+                REQUIRE(jwt::decode("not a jwt", cache) == nullptr);
+            }
+        }
+    }
+}
+
+SCENARIO("Tokens can be verified without decoding their payload") {
+    GIVEN("A token signed with HS256") {
+        json payload{ { "sub", "1234567890" } };
+        auto encoded = jwt::encode(payload, "secret", "HS256");
+
+        THEN("it verifies with the right key and alg") {
+            REQUIRE(jwt::verify(encoded, "secret") == jwt::VerifyStatus::Ok);
+            REQUIRE(jwt::verify(encoded, "secret", { "HS256" }) == jwt::VerifyStatus::Ok);
+        }
+
+        THEN("the wrong key, a disallowed alg or a tampered signature are told apart") {
+            REQUIRE(jwt::verify(encoded, "other") == jwt::VerifyStatus::InvalidSignature);
+            REQUIRE(jwt::verify(encoded, "secret", { "RS256" }) == jwt::VerifyStatus::AlgNotAllowed);
+            REQUIRE(jwt::verify(encoded.substr(0, encoded.size() - 2), "secret") == jwt::VerifyStatus::InvalidSignature);
+        }
+    }
+
+    GIVEN("An unsigned token whose payload isn't even base64url") {
+        // {"alg":"none"}
+        string encoded{ "eyJhbGciOiJub25lIn0.!!!." };
+
+        THEN("it still verifies since the payload is never looked at") {
+            REQUIRE(jwt::verify(encoded, "") == jwt::VerifyStatus::Ok);
+            REQUIRE(jwt::verify(encoded, "secret") == jwt::VerifyStatus::AlgNotAllowed);
+        }
+    }
+
+    GIVEN("Malformed tokens") {
+        // {"alg":"XY256"}
+        string unsupported{ "eyJhbGciOiJYWTI1NiJ9.e30." };
+
+        THEN("they are rejected before any signature work") {
+            REQUIRE(jwt::verify("not a jwt", "secret") == jwt::VerifyStatus::Malformed);
+            REQUIRE(jwt::verify("e30.e30.", "secret") == jwt::VerifyStatus::Malformed);
+            REQUIRE(jwt::verify(unsupported, "secret") == jwt::VerifyStatus::UnsupportedAlg);
+        }
+    }
+
+    GIVEN("A token whose alg is longer than any supported one") {
+        string header{ R"({"alg":"HS256-but-much-longer-than-that"})" };
+        auto encoded = jwt::detail::b64encode((const uint8_t*)header.data(), header.length()) + ".e30.";
+
+        THEN("it is reported as unsupported rather than malformed") {
+            REQUIRE(jwt::verify(encoded, "secret") == jwt::VerifyStatus::UnsupportedAlg);
+        }
+    }
+}
+
+SCENARIO("Payloads can be decoded into an arena") {
+    GIVEN("A token and an arena") {
+        json payload{ { "sub", "1234567890" }, { "roles", { "admin", "user" } }, { "exp", 1516239022 } };
+        auto encoded = jwt::encode(payload, "secret");
+        jwt::Arena arena{ 256 };
+
+        WHEN("it is decoded into the arena") {
+            auto decoded = jwt::decode(encoded, "secret", arena);
+
+            THEN("the payload lives in the arena") {
+                REQUIRE(decoded["sub"].get<jwt::ArenaString>() == "1234567890");
+                REQUIRE(decoded["roles"].size() == 2);
+                REQUIRE(decoded["exp"] == 1516239022);
+                REQUIRE(arena.used() > 0);
+            }
+        }
+
+        WHEN("it is decoded with the wrong key") {
+            THEN("nothing is allocated") {
+                REQUIRE(jwt::decode(encoded, "other", arena) == nullptr);
+                REQUIRE(arena.used() == 0);
+            }
+        }
+
+        WHEN("the arena is reset after many decodes") {
+            for (int i = 0; i < 16; ++i) {
+                jwt::decode(encoded, "secret", arena);
+            }
+
+            arena.reset();
+
+            THEN("it can be reused") {
+                REQUIRE(arena.used() == 0);
+                REQUIRE(jwt::decode(encoded, "secret", arena)["sub"].get<jwt::ArenaString>() == "1234567890");
+            }
+        }
+    }
+
+    GIVEN("A token decoded into an arena through the limits and the header cache") {
+        json payload{ { "sub", "1234567890" }, { "roles", { "admin", "user" } } };
+        auto encoded = jwt::encode(payload, "secret", "HS256");
+        jwt::Arena arena{ 256 };
+        jwt::Limits limits{};
+        jwt::VerifyStatus status{};
+        jwt::HeaderCache cache{ [](const string&, jwt::Alg, string& key) {
+            key = "secret";
+            return true;
+        } };
+
+        WHEN("it is decoded with limits") {
+            auto decoded = jwt::decode(encoded, "secret", limits, status, arena);
+
+            THEN("the payload lives in the arena") {
+                REQUIRE(status == jwt::VerifyStatus::Ok);
+                REQUIRE(decoded["sub"].get<jwt::ArenaString>() == "1234567890");
+                REQUIRE(decoded["roles"].size() == 2);
+                REQUIRE(arena.used() > 0);
+            }
+        }
+
+        WHEN("it is decoded with limits it's over") {
+            limits.maxClaims = 1;
+
+            auto decoded = jwt::decode(encoded, "secret", limits, status, arena);
+
+            THEN("it is rejected") {
+                REQUIRE(decoded == nullptr);
+                REQUIRE(status == jwt::VerifyStatus::LimitExceeded);
+            }
+        }
+
+        WHEN("it is decoded through the header cache") {
+            auto decoded = jwt::decode(encoded, cache, arena);
+
+            THEN("the payload lives in the arena") {
+                REQUIRE(decoded["sub"].get<jwt::ArenaString>() == "1234567890");
+                REQUIRE(arena.used() > 0);
+                REQUIRE(jwt::decode(encoded, cache, arena, { "RS256" }) == nullptr);
+            }
+        }
+    }
+
+    GIVEN("An arena json made outside of any arena") {
+        jwt::ArenaJson value{ { "sub", "1234567890" } };
+
+        THEN("it falls back to the heap") {
+            REQUIRE(value.dump() == R"({"sub":"1234567890"})");
+        }
+    }
+}
+
+SCENARIO("Tokens can be encoded into an arena") {
+    GIVEN("A payload, an RS256 key pair and an arena") {
+        json payload{ { "sub", "1234567890" }, { "roles", { "admin", "user" } } };
+        support::KeyPair keys{};
+        jwt::Arena arena{ 4096 };
+
+        REQUIRE(support::makeKeyPair("RS256", keys));
+
+        WHEN("it is encoded into the arena") {
+            auto encoded = jwt::encode(payload, keys.signing, arena, "RS256");
+
+            THEN("the token lives in the arena and verifies") {
+                REQUIRE(arena.used() > 0);
+                REQUIRE(jwt::decode(string{ encoded.c_str() }, keys.verifying) == payload);
+            }
+        }
+
+        WHEN("it is encoded with an alg that isn't supported") {
+            THEN("it fails like encode") {
+                REQUIRE(jwt::encode(payload, keys.signing, arena, "RS999").empty());
+                REQUIRE(jwt::encode(payload, keys.signing, "RS999").empty());
+            }
+        }
+
+        WHEN("it is encoded and decoded again once the arena has grown") {
+            auto warm = jwt::encode(payload, keys.signing, arena, "RS256");
+
+            jwt::decode(string{ warm.c_str() }, keys.verifying, arena);
+            arena.reset();
+
+            jwt::ArenaString encoded{};
+            auto encode = countAllocations([&]() { encoded = jwt::encode(payload, keys.signing, arena, "RS256"); });
+            string token{ encoded.c_str() };
+            jwt::ArenaJson decoded{};
+            auto decode = countAllocations([&]() { decoded = jwt::decode(token, keys.verifying, arena); });
+
+            THEN("the signature and the parse stack stay off the heap") {
+                // Only the serializer's output adapter and indent buffer for encode, and nlohmann's
+                // token buffer and parser stack for decode.
+                REQUIRE(decoded["sub"].get<jwt::ArenaString>() == "1234567890");
+                REQUIRE(encode.news <= 2);
+                REQUIRE(decode.news <= 7);
+            }
+        }
+    }
+}
+
+SCENARIO("Tokens over the parsing limits are rejected and counted") {
+    GIVEN("Limits and tokens on either side of them") {
+        jwt::Limits limits{};
+
+        limits.maxTokenSize = 512;
+        limits.maxPayloadSize = 256;
+        limits.maxDepth = 4;
+        limits.maxClaims = 3;
+
+        json small{ { "sub", "1234567890" }, { "roles", { { "admin", true } } } };
+        json large{ { "sub", string(300, 'a') } };
+        json huge{ { "sub", string(600, 'a') } };
+        json deep{ { "a", { { "b", { { "c", { { "d", { { "e", 1 } } } } } } } } } };
+        json wide{ { "a", 1 }, { "b", 2 }, { "c", 3 }, { "d", 4 } };
+        auto before = jwt::limitViolations();
+        jwt::VerifyStatus status{};
+
+        WHEN("a token within the limits is decoded") {
+            auto decoded = jwt::decode(jwt::encode(small, "secret"), "secret", limits, status);
+
+            THEN("it decodes") {
+                REQUIRE(status == jwt::VerifyStatus::Ok);
+                REQUIRE(decoded == small);
+            }
+        }
+
+        WHEN("tokens over each limit are decoded") {
+            auto largeDecoded = jwt::decode(jwt::encode(large, "secret"), "secret", limits, status);
+            auto largeStatus = status;
+            auto hugeDecoded = jwt::decode(jwt::encode(huge, "secret"), "secret", limits, status);
+            auto hugeStatus = status;
+            auto deepDecoded = jwt::decode(jwt::encode(deep, "secret"), "secret", limits, status);
+            auto deepStatus = status;
+            auto wideDecoded = jwt::decode(jwt::encode(wide, "secret"), "secret", limits, status);
+            auto wideStatus = status;
+            auto after = jwt::limitViolations();
+
+            THEN("each is rejected with its own count") {
+                REQUIRE(largeDecoded == nullptr);
+                REQUIRE(largeStatus == jwt::VerifyStatus::LimitExceeded);
+                REQUIRE(hugeDecoded == nullptr);
+                REQUIRE(hugeStatus == jwt::VerifyStatus::LimitExceeded);
+                REQUIRE(deepDecoded == nullptr);
+                REQUIRE(deepStatus == jwt::VerifyStatus::LimitExceeded);
+                REQUIRE(wideDecoded == nullptr);
+                REQUIRE(wideStatus == jwt::VerifyStatus::LimitExceeded);
+                REQUIRE(after.payloadSize == before.payloadSize + 1);
+                REQUIRE(after.tokenSize == before.tokenSize + 1);
+                REQUIRE(after.depth == before.depth + 1);
+                REQUIRE(after.claims == before.claims + 1);
+            }
+        }
+
+        WHEN("a token with a large payload is only verified") {
+            THEN("just the token's size matters") {
+                REQUIRE(jwt::verify(jwt::encode(large, "secret"), "secret", limits) == jwt::VerifyStatus::Ok);
+                REQUIRE(jwt::verify(jwt::encode(huge, "secret"), "secret", limits) == jwt::VerifyStatus::LimitExceeded);
+            }
+        }
+
+        WHEN("a token with a payload that isn't json is decoded") {
+            // {"alg":"none"} and {"sub":
+            auto decoded = jwt::decode("eyJhbGciOiJub25lIn0.eyJzdWIiOg.", "", limits, status);
+
+            THEN("it is malformed rather than thrown") {
+                REQUIRE(decoded == nullptr);
+                REQUIRE(status == jwt::VerifyStatus::Malformed);
+            }
+        }
+
+        WHEN("a token with nested arrays and a repeated claim is decoded") {
+            string raw{ R"({"sub":"a","roles":[1,[2,{"x":18446744073709551615}],-1.5,false,null],"sub":"b"})" };
+            auto encoded = "eyJhbGciOiJub25lIn0." + jwt::detail::b64encode((const uint8_t*)raw.data(), raw.length()) + ".";
+            auto decoded = jwt::decode(encoded, "", limits, status);
+
+            THEN("it decodes the same as without limits") {
+                REQUIRE(status == jwt::VerifyStatus::Ok);
+                REQUIRE(decoded == json::parse(raw));
+                REQUIRE(decoded == jwt::decode(encoded, ""));
+                REQUIRE(decoded["sub"] == "b");
+            }
+        }
+    }
+}
+
+SCENARIO("Latencies are recorded into log-linear histograms") {
+    GIVEN("A histogram") {
+        jwt::LatencyHistogram histogram{};
+
+        WHEN("a thousand evenly spread values are recorded") {
+            for (uint64_t i = 1; i <= 1000; ++i) {
+                histogram.record(i * 1000);
+            }
+
+            THEN("percentiles are within a bucket of the truth") {
+                REQUIRE(histogram.count() == 1000);
+                REQUIRE(histogram.sum() == 500500000);
+                REQUIRE(histogram.percentile(0.5) >= 500000);
+                REQUIRE(histogram.percentile(0.5) <= 500000 * 1.04);
+                REQUIRE(histogram.percentile(0.99) >= 990000);
+                REQUIRE(histogram.percentile(0.99) <= 990000 * 1.04);
+                REQUIRE(histogram.countAtOrBelow(0) == 0);
+                REQUIRE(histogram.countAtOrBelow(2000000) == 1000);
+            }
+        }
+
+        WHEN("values fall at the edges of its range") {
+            histogram.record(0);
+            histogram.record(31);
+            histogram.record(1ull << 40);
+
+            THEN("small values are exact and huge ones land in the last bucket") {
+                REQUIRE(jwt::LatencyHistogram::bucketFor(31) == 31);
+                REQUIRE(jwt::LatencyHistogram::bucketTop(31) == 31);
+                REQUIRE(jwt::LatencyHistogram::bucketFor(1ull << 40) == jwt::LatencyHistogram::BucketCount - 1);
+                REQUIRE(histogram.percentile(0.67) == 31);
+                REQUIRE(histogram.percentile(1) == jwt::LatencyHistogram::bucketTop(jwt::LatencyHistogram::BucketCount - 1));
+            }
+        }
+
+        THEN("every bucket's top value maps back to it") {
+            for (size_t i = 0; i < jwt::LatencyHistogram::BucketCount; ++i) {
+                REQUIRE(jwt::LatencyHistogram::bucketFor(jwt::LatencyHistogram::bucketTop(i)) == i);
+                REQUIRE(jwt::LatencyHistogram::bucketFor(jwt::LatencyHistogram::bucketTop(i) + 1) == (i + 1 < jwt::LatencyHistogram::BucketCount ? i + 1 : i));
+            }
+        }
+    }
+}
+
+SCENARIO("Sampled decodes are checked against the reference implementation") {
+    GIVEN("Tokens signed with HS256 and ES256") {
+        json payload{ { "sub", "1234567890" }, { "admin", true } };
+        support::KeyPair es256{};
+
+        REQUIRE(support::makeKeyPair("ES256", es256));
+
+        auto hs256 = jwt::encode(payload, "secret", "HS256");
+        auto es = jwt::encode(payload, es256.signing, "ES256");
+        auto tampered = hs256.substr(0, hs256.rfind('.') + 1) + "AAAA";
+
+        WHEN("they are decoded through a shadow verifier sampling every call") {
+            jwt::ShadowVerifier shadow{ 1 };
+
+            auto first = shadow.decode(hs256, "secret");
+            auto second = shadow.decode(es, es256.verifying, { "ES256" });
+            auto third = shadow.decode(tampered, "secret");
+            auto fourth = shadow.decode(hs256, "secret", { "RS256" });
+
+            REQUIRE_THROWS(shadow.decode(jwt::encode(payload, "secret").replace(0, hs256.find('.'), "bm90IGpzb24"), "secret"));
+            shadow.drain();
+
+            THEN("the fast path agrees with the reference on all of them") {
+                REQUIRE(first == payload);
+                REQUIRE(second == payload);
+                REQUIRE(third == nullptr);
+                REQUIRE(fourth == nullptr);
+                REQUIRE(shadow.checked() == 5);
+                REQUIRE(shadow.mismatches() == 0);
+                REQUIRE(shadow.dropped() == 0);
+            }
+        }
+
+        WHEN("a decoder that disagrees is checked one call in two") {
+            vector<jwt::ShadowMismatch> mismatches{};
+
+            jwt::ShadowVerifier shadow{ 2, [](const string& jwt, const string& key, const set<string>& alg) {
+                auto decoded = jwt::decode(jwt, key, alg);
+
+                if (decoded.is_object()) {
+                    decoded["admin"] = false;
+                }
+
+                return decoded;
+            }, [&](const jwt::ShadowMismatch& mismatch) {
+                mismatches.push_back(mismatch);
+            } };
+
+            for (int i = 0; i < 4; ++i) {
+                shadow.decode(hs256, "secret");
+            }
+
+            shadow.decode(tampered, "secret");
+            shadow.drain();
+
+            THEN("the sampled disagreements are reported with the token's shape") {
+                REQUIRE(shadow.checked() == 3);
+                REQUIRE(shadow.mismatches() == 2);
+                REQUIRE(mismatches.size() == 2);
+                REQUIRE(mismatches[0].fastVerified);
+                REQUIRE(mismatches[0].referenceVerified);
+                REQUIRE(mismatches[0].token.alg == jwt::Alg::HS256);
+                REQUIRE(mismatches[0].token.tokenSize == hs256.length());
+                REQUIRE(json::parse(mismatches[0].token.payload) == json({ { "sub", "xxxxxxxxxx" }, { "admin", true } }));
+            }
+        }
+    }
+}
+
+#ifdef JWT_INSTRUMENTATION
+namespace {
+    struct RecordingSink : jwt::InstrumentationSink {
+        RecordingSink() {
+            jwt::setInstrumentationSink(this);
+        }
+
+        ~RecordingSink() {
+            jwt::setInstrumentationSink(nullptr);
+        }
+
+        void record(const jwt::CallRecord& call) override {
+            calls.push_back(call);
+        }
+
+        uint64_t ticks(jwt::Stage stage) const {
+            return calls.back().ticks[(size_t)stage];
+        }
+
+        vector<jwt::CallRecord> calls{};
+    };
+}
+
+SCENARIO("Calls are timed per stage when a sink is registered") {
+    GIVEN("A sink and an HS256 token") {
+        json payload{ { "sub", "1234567890" } };
+        auto encoded = jwt::encode(payload, "secret", "HS256");
+
+        WHEN("it is decoded") {
+            RecordingSink sink{};
+            auto decoded = jwt::decode(encoded, "secret");
+
+            THEN("one call is recorded with the stages it went through") {
+                REQUIRE(decoded == payload);
+                REQUIRE(sink.calls.size() == 1);
+                REQUIRE(sink.calls[0].operation == jwt::Operation::Decode);
+                REQUIRE(sink.calls[0].alg == jwt::Alg::HS256);
+                REQUIRE(sink.calls[0].outcome == jwt::Outcome::Ok);
+                REQUIRE(sink.calls[0].tokenSize == encoded.length());
+                REQUIRE(sink.ticks(jwt::Stage::Header) > 0);
+                REQUIRE(sink.ticks(jwt::Stage::Signature) > 0);
+                REQUIRE(sink.ticks(jwt::Stage::Payload) > 0);
+                REQUIRE(sink.ticks(jwt::Stage::Key) == 0);
+                REQUIRE(sink.calls[0].totalTicks >= sink.ticks(jwt::Stage::Signature));
+            }
+        }
+
+        WHEN("it is encoded, decoded with the wrong key and verified against other algs") {
+            RecordingSink sink{};
+            jwt::VerifyStatus status{};
+
+            jwt::encode(payload, "secret", "HS384");
+            jwt::decode(encoded, "other");
+            jwt::verify(encoded, "secret", { "RS256" });
+            jwt::decode(encoded, "secret", jwt::Limits{}, status);
+
+            THEN("each outcome is recorded once") {
+                REQUIRE(sink.calls.size() == 4);
+                REQUIRE(sink.calls[0].operation == jwt::Operation::Encode);
+                REQUIRE(sink.calls[0].alg == jwt::Alg::HS384);
+                REQUIRE(sink.calls[0].ticks[(size_t)jwt::Stage::Serialize] > 0);
+                REQUIRE(sink.calls[1].outcome == jwt::Outcome::BadSignature);
+                REQUIRE(sink.calls[2].operation == jwt::Operation::Verify);
+                REQUIRE(sink.calls[2].outcome == jwt::Outcome::AlgRejected);
+                REQUIRE(sink.calls[3].operation == jwt::Operation::Decode);
+                REQUIRE(sink.calls[3].outcome == jwt::Outcome::Ok);
+            }
+        }
+    }
+
+    GIVEN("No sink") {
+        THEN("nothing is recorded") {
+            RecordingSink sink{};
+
+            jwt::setInstrumentationSink(nullptr);
+            jwt::decode(jwt::encode({ { "sub", "1" } }, "secret"), "secret");
+
+            REQUIRE(sink.calls.empty());
+        }
+    }
+}
+
+SCENARIO("Arena calls record their own outcome") {
+    GIVEN("A sink, an arena and HS256 tokens with a json payload and one that isn't json") {
+        json payload{ { "sub", "1234567890" } };
+        auto encoded = jwt::encode(payload, "secret", "HS256");
+        auto message = jwt::detail::b64encode((const uint8_t*)R"({"alg":"HS256"})", 15) + "." + jwt::detail::b64encode((const uint8_t*)"{\"sub\":", 7);
+        auto notJson = message + "." + jwt::detail::signHMAC(message, "secret", "HS256");
+        jwt::Arena arena{};
+
+        WHEN("they are decoded and encoded through the arena") {
+            RecordingSink sink{};
+            jwt::VerifyStatus status{};
+
+            jwt::decode(encoded, "secret", arena);
+            REQUIRE_THROWS(jwt::decode(notJson, "secret", arena));
+            jwt::decode(notJson, "secret", jwt::Limits{}, status, arena);
+            jwt::encode(payload, "secret", arena, "HS256");
+
+            THEN("a payload that isn't json is recorded as malformed once its signature checks out") {
+                REQUIRE(sink.calls.size() == 4);
+                REQUIRE(sink.calls[0].outcome == jwt::Outcome::Ok);
+                REQUIRE(sink.calls[1].outcome == jwt::Outcome::Malformed);
+                REQUIRE(sink.calls[2].outcome == jwt::Outcome::Malformed);
+                REQUIRE(status == jwt::VerifyStatus::Malformed);
+                REQUIRE(sink.calls[3].operation == jwt::Operation::Encode);
+                REQUIRE(sink.calls[3].outcome == jwt::Outcome::Ok);
+            }
+        }
+    }
+}
+
+SCENARIO("Calls are counted and exported as Prometheus text") {
+    GIVEN("A metrics registry and an HS256 token") {
+        jwt::MetricsRegistry metrics{};
+        json payload{ { "sub", "1234567890" } };
+        auto encoded = jwt::encode(payload, "secret", "HS256");
+
+        jwt::HeaderCache cache{ [](const string&, jwt::Alg, string& key) {
+            key = "secret";
+            return true;
+        } };
+
+        WHEN("tokens are decoded with every outcome") {
+            jwt::setInstrumentationSink(&metrics);
+            jwt::decode(encoded, "secret");
+            jwt::decode(encoded, "secret");
+            jwt::decode(encoded, "other");
+            jwt::verify(encoded, "secret", { "RS256" });
+            jwt::decode("not a token", "secret");
+            jwt::decode(encoded, cache);
+            jwt::decode(encoded, cache);
+            jwt::setInstrumentationSink(nullptr);
+
+            metrics.recordExpired(jwt::Alg::HS256);
+
+            auto text = metrics.prometheusText();
+
+            THEN("each alg and outcome has its own series") {
+                REQUIRE(metrics.calls(jwt::Operation::Decode, jwt::Alg::HS256, jwt::Outcome::Ok) == 4);
+                REQUIRE(metrics.calls(jwt::Operation::Decode, jwt::Alg::HS256, jwt::Outcome::BadSignature) == 1);
+                REQUIRE(metrics.calls(jwt::Operation::Verify, jwt::Alg::HS256, jwt::Outcome::AlgRejected) == 1);
+                REQUIRE(metrics.calls(jwt::Operation::Decode, jwt::Alg::Unknown, jwt::Outcome::Malformed) == 1);
+                REQUIRE(metrics.calls(jwt::Operation::Encode, jwt::Alg::HS256, jwt::Outcome::Ok) == 0);
+                REQUIRE(metrics.latency(jwt::Operation::Decode, jwt::Alg::HS256, jwt::Outcome::Ok)->sum() > 0);
+                REQUIRE(metrics.cacheHits() == 1);
+                REQUIRE(metrics.cacheMisses() == 1);
+                REQUIRE(metrics.expired(jwt::Alg::HS256) == 1);
+            }
+
+            THEN("the text exposition has a line per series") {
+                REQUIRE(text.find("# TYPE jwt_call_duration_seconds histogram\n") != string::npos);
+                REQUIRE(text.find("jwt_call_duration_seconds_count{operation=\"decode\",alg=\"HS256\",outcome=\"ok\"} 4\n") != string::npos);
+                REQUIRE(text.find("jwt_call_duration_seconds_bucket{operation=\"decode\",alg=\"HS256\",outcome=\"bad_signature\",le=\"+Inf\"} 1\n") != string::npos);
+                REQUIRE(text.find("jwt_call_duration_seconds_count{operation=\"verify\",alg=\"HS256\",outcome=\"alg_rejected\"} 1\n") != string::npos);
+                REQUIRE(text.find("jwt_call_duration_seconds_count{operation=\"decode\",alg=\"unknown\",outcome=\"malformed\"} 1\n") != string::npos);
+                REQUIRE(text.find("jwt_stage_seconds_total{operation=\"decode\",alg=\"HS256\",stage=\"signature\"}") != string::npos);
+                REQUIRE(text.find("jwt_header_cache_lookups_total{result=\"hit\"} 1\n") != string::npos);
+                REQUIRE(text.find("jwt_expired_total{alg=\"HS256\"} 1\n") != string::npos);
+                REQUIRE(text.find("operation=\"encode\"") == string::npos);
+            }
+        }
+
+        WHEN("the text is exported under a global locale with decimal commas and digit grouping") {
+            struct CommaPunct : numpunct<char> {
+                char do_decimal_point() const override {
+                    return ',';
+                }
+
+                char do_thousands_sep() const override {
+                    return '.';
+                }
+
+                string do_grouping() const override {
+                    return "\3";
+                }
+            };
+
+            jwt::CallRecord call{};
+
+            call.alg = jwt::Alg::HS256;
+            call.totalTicks = 123456789;
+            call.ticks[(size_t)jwt::Stage::Signature] = 123456789;
+
+            for (int i = 0; i < 1234; ++i) {
+                metrics.record(call);
+            }
+
+            auto previous = locale::global(locale{ locale::classic(), new CommaPunct{} });
+            auto text = metrics.prometheusText();
+
+            locale::global(previous);
+
+            auto sumLine = string{ "jwt_call_duration_seconds_sum{operation=\"decode\",alg=\"HS256\",outcome=\"ok\"} " };
+            auto sumAt = text.find(sumLine);
+
+            REQUIRE(sumAt != string::npos);
+
+            auto sum = text.substr(sumAt + sumLine.length(), text.find('\n', sumAt) - sumAt - sumLine.length());
+
+            THEN("numbers are still written the way Prometheus reads them") {
+                REQUIRE(text.find("le=\"0.001\"} 0\n") != string::npos);
+                REQUIRE(text.find("le=\"2.5e-06\"} 0\n") != string::npos);
+                REQUIRE(text.find("jwt_call_duration_seconds_count{operation=\"decode\",alg=\"HS256\",outcome=\"ok\"} 1234\n") != string::npos);
+                REQUIRE(sum.find(',') == string::npos);
+                REQUIRE(sum.length() > 10);
+                REQUIRE(sum[sum.length() - 10] == '.');
+            }
+        }
+    }
+}
+
+SCENARIO("Sampled decodes are captured with their claim values blanked out") {
+    GIVEN("A capture with room for two samples in front of a recording sink") {
+        RecordingSink sink{};
+        jwt::TrafficCapture capture{ &sink };
+        auto path = string{ "capture_test.bin" };
+
+        REQUIRE(capture.open(path, 2, 1));
+
+        json payload{ { "sub", "1234567890" }, { "exp", 1700000000 }, { "aud", { "api" } }, { "admin", true } };
+        auto encoded = jwt::encode(payload, "secret", "HS256");
+
+        WHEN("three tokens are decoded") {
+            jwt::setInstrumentationSink(&capture);
+            jwt::decode(jwt::encode({ { "sub", "first" } }, "secret"), "secret");
+            jwt::decode(encoded, "secret");
+            jwt::decode(encoded, "other");
+            jwt::setInstrumentationSink(nullptr);
+            capture.flush();
+
+            vector<jwt::CapturedToken> captured{};
+
+            REQUIRE(jwt::readCapture(path, captured));
+
+            THEN("the newest two are kept with their shapes and outcomes") {
+                // The sink also saw the encodes, the first of them before the capture was installed.
+                REQUIRE(sink.calls.size() == 5);
+                REQUIRE(capture.captured() == 3);
+                REQUIRE(captured.size() == 2);
+                REQUIRE(captured[0].alg == jwt::Alg::HS256);
+                REQUIRE(captured[0].outcome == jwt::Outcome::Ok);
+                REQUIRE(captured[1].outcome == jwt::Outcome::BadSignature);
+                REQUIRE(captured[0].tokenSize == encoded.length());
+                REQUIRE(captured[0].tokenHash == captured[1].tokenHash);
+                REQUIRE(json::parse(captured[0].header) == json({ { "alg", "HS256" }, { "typ", "JWT" } }));
+                REQUIRE(captured[0].payloadSize == payload.dump().length());
+                REQUIRE(json::parse(captured[0].payload) == json({ { "sub", "xxxxxxxxxx" }, { "exp", 9999999999 }, { "aud", { "xxx" } }, { "admin", true } }));
+            }
+        }
+
+        WHEN("a token isn't a jwt at all") {
+            jwt::setInstrumentationSink(&capture);
+            jwt::decode("garbage", "secret");
+            jwt::setInstrumentationSink(nullptr);
+            capture.flush();
+
+            vector<jwt::CapturedToken> captured{};
+
+            REQUIRE(jwt::readCapture(path, captured));
+
+            THEN("only its size and outcome are kept") {
+                REQUIRE(captured.size() == 1);
+                REQUIRE(captured[0].outcome == jwt::Outcome::Malformed);
+                REQUIRE(captured[0].tokenSize == 7);
+                REQUIRE(captured[0].header.empty());
+                REQUIRE(captured[0].payload.empty());
+            }
+        }
+
+        WHEN("a capture is destroyed before it's flushed") {
+            auto otherPath = string{ "capture_test_other.bin" };
+
+            {
+                jwt::TrafficCapture other{};
+
+                REQUIRE(other.open(otherPath, 2, 1));
+
+                jwt::setInstrumentationSink(&other);
+                jwt::decode(encoded, "secret");
+                jwt::setInstrumentationSink(nullptr);
+            }
+
+            vector<jwt::CapturedToken> captured{};
+
+            REQUIRE(jwt::readCapture(otherPath, captured));
+            remove(otherPath.c_str());
+
+            THEN("its queued samples are still written") {
+                REQUIRE(captured.size() == 1);
+                REQUIRE(captured[0].outcome == jwt::Outcome::Ok);
+            }
+        }
+
+        remove(path.c_str());
+    }
+}
+#endif
\ No newline at end of file